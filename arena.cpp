@@ -0,0 +1,33 @@
+#include "arena.h"
+
+#include <algorithm>
+
+
+namespace AST {
+
+void Arena::reset()
+{
+    if (blocks_.empty()) {
+        return;
+    }
+    blocks_.resize(1);
+    cur_ = reinterpret_cast<uintptr_t>(blocks_.front().get());
+    end_ = cur_ + BLOCK_SIZE;
+}
+
+void *Arena::allocateSlow(size_t size, size_t align)
+{
+    // oversized objects get a block of their own
+    size_t blockSize = std::max(BLOCK_SIZE, size + align);
+    auto &block = blocks_.emplace_back(new std::byte[blockSize]);
+
+    auto begin = reinterpret_cast<uintptr_t>(block.get());
+    auto cur = (begin + align - 1) & ~(align - 1);
+    if (blockSize == BLOCK_SIZE) {
+        cur_ = cur + size;
+        end_ = begin + blockSize;
+    }
+    return reinterpret_cast<void*>(cur);
+}
+
+} // namespace AST
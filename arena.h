@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace AST {
+
+// Bump allocator for the nodes of one top-level item.
+// Nodes are never destroyed one by one, all the memory is released at
+// once by reset() or the destructor, so only trivially destructible
+// types may live here.
+class Arena {
+public:
+    static constexpr size_t BLOCK_SIZE = 16 * 1024;
+
+    Arena() = default;
+    ~Arena() = default;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    Arena(Arena&&) = default;
+    Arena& operator=(Arena&&) = default;
+
+    template <class T, class... Args>
+    T *make(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible_v<T>,
+                      "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template <class T>
+    std::span<T> copy(const std::vector<T>& values)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (values.empty()) {
+            return {};
+        }
+        auto *data = static_cast<T*>(allocate(sizeof(T) * values.size(), alignof(T)));
+        std::uninitialized_copy(values.begin(), values.end(), data);
+        return { data, values.size() };
+    }
+
+    void *allocate(size_t size, size_t align)
+    {
+        auto cur = (cur_ + align - 1) & ~(align - 1);
+        if (cur + size > end_) {
+            return allocateSlow(size, align);
+        }
+        cur_ = cur + size;
+        return reinterpret_cast<void*>(cur);
+    }
+
+    // drops everything, keeps the first block for the next item
+    void reset();
+
+private:
+    void *allocateSlow(size_t size, size_t align);
+
+    std::vector<std::unique_ptr<std::byte[]>> blocks_;
+    uintptr_t cur_ = 0;
+    uintptr_t end_ = 0;
+};
+
+} // namespace AST
@@ -1,5 +1,7 @@
 #include "ast.h"
+#include "codegen.h"
 
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/Verifier.h"
 
 #include <ranges>
@@ -7,9 +9,9 @@
 
 namespace AST {
 
-llvm::Function *findFunction(std::string name)
+llvm::Function *findFunction(Symbol::Id name)
 {
-    if (auto *func = Context::IRManager::getModule()->getFunction(name)) {
+    if (auto *func = Context::IRManager::getModule()->getFunction(Symbol::name(name))) {
         return func;
     }
 
@@ -22,12 +24,27 @@ llvm::Function *findFunction(std::string name)
 }
 
 // Loggers
-std::unique_ptr<ExpressionAST> LogError(const char *Str)
+namespace {
+thread_local std::string *__errorSink = nullptr;
+} // namespace
+
+ExpressionAST *LogError(const char *Str)
 {
+    if (__errorSink) {
+        *__errorSink += "Found shit: ";
+        *__errorSink += Str;
+        *__errorSink += '\n';
+        return nullptr;
+    }
     fprintf(stderr, "Found shit: %s\n", Str);
     return nullptr;
 }
 
+void redirectErrors(std::string *sink)
+{
+    __errorSink = sink;
+}
+
 llvm::Value *LogErrorV(const char *str)
 {
     LogError(str);
@@ -50,14 +67,13 @@ std::unique_ptr<FunctionAST> LogErrorF(const char *str)
 
 // Value
 ValueAST::ValueAST(int64_t value)
-    : value_(value)
+    : ExpressionAST(Kind::VALUE),
+    value_(value)
 { }
 
 llvm::Value *ValueAST::codeGen() const
 {
-    return llvm::ConstantInt::get(
-            *Context::IRManager::getCtx(),
-            llvm::APInt(64, value_));
+    return Codegen::constant(value_);
 }
 
 void ValueAST::debugPrint([[ maybe_unused ]] int layer) const
@@ -66,74 +82,124 @@ IFDEBUG({
     debug(layer, "Value: ", value_);
 })
 
+bool ValueAST::hasSideEffects() const
+{
+    return false;
+}
+
+ExpressionAST *ValueAST::fold([[ maybe_unused ]] Arena &arena)
+{
+    return this;
+}
+
+int64_t ValueAST::getValue() const
+{
+    return value_;
+}
+
 // Variable
-VarAST::VarAST(std::string name)
-    : name_(std::move(name))
+VarAST::VarAST(Symbol::Id name)
+    : ExpressionAST(Kind::VAR),
+    name_(name)
 { }
 
 llvm::Value *VarAST::codeGen() const
 {
-    llvm::Value *value = Context::IRManager::getValues()[name_];
-    return value
-        ? value
-        : Context::IRManager::getBuilder()->CreateAlloca(
-            llvm::Type::getInt64Ty(*Context::IRManager::getCtx()),
-            nullptr,
-            name_);
+    return Codegen::variable(name_);
 }
 
 void VarAST::debugPrint([[ maybe_unused ]] int layer) const
 IFDEBUG({
     ++layer;
-    debug(layer, "Var: ", name_);
+    debug(layer, "Var: ", Symbol::name(name_));
 })
 
+bool VarAST::hasSideEffects() const
+{
+    return false;
+}
+
+ExpressionAST *VarAST::fold([[ maybe_unused ]] Arena &arena)
+{
+    return this;
+}
+
+Symbol::Id VarAST::getName() const
+{
+    return name_;
+}
+
 // Binary operator
 BinaryExprAST::BinaryExprAST(
-        std::string op,
-        std::unique_ptr<ExpressionAST> lhs,
-        std::unique_ptr<ExpressionAST> rhs)
-    : op_(op),
-    lhs_(std::move(lhs)),
-    rhs_(std::move(rhs))
-{ }
+        Opcode op,
+        ExpressionAST *lhs,
+        ExpressionAST *rhs)
+    : ExpressionAST(Kind::BINARY),
+    op_(op),
+    lhs_(lhs),
+    rhs_(rhs)
+{
+    updateSideEffects();
+}
 
 llvm::Value *BinaryExprAST::codeGen() const
 {
-    llvm::Value *lhs = lhs_->codeGen();
-    llvm::Value *rhs = rhs_->codeGen();
-    if (!lhs || !rhs) {
-        return nullptr;
-    }
-
-    if (op_ == "+") {
-        return Context::IRManager::getBuilder()->CreateAdd(lhs, rhs, "addtmp");
-    }
-    if (op_ == "-") {
-        return Context::IRManager::getBuilder()->CreateSub(lhs, rhs, "rhssubtmp");
-    }
-    if (op_ == "*") {
-        return Context::IRManager::getBuilder()->CreateMul(lhs, rhs, "rhsmultmp");
-    }
-    if (op_ == "/") {
-        return nullptr;
-        // return ASTMeta::getBuilder()->CreateFP(lhs, rhs, "rhsdivtmp");
-    }
-    if (op_ == "<") {
-        return less(lhs, rhs);
-    }
-    if (op_ == ">") {
-        return less(rhs, lhs);
+    // Post order with an explicit stack of operator nodes, the rest are
+    // leaves, so long operator chains do not grow the native stack.
+    // An entry waits for its rhs once its lhs is set.
+    struct Pending {
+        const BinaryExprAST *binary;
+        llvm::Value *lhs = nullptr;
+    };
+    llvm::SmallVector<Pending, 16> stack;
+
+    const ExpressionAST *expr = this;
+    while (true) {
+        while (auto *binary = llvm::dyn_cast<BinaryExprAST>(expr)) {
+            stack.push_back({ binary });
+            // the lhs of '=' is a name, not a value
+            expr = binary->op_ == Opcode::ASSIGN ? binary->rhs_ : binary->lhs_;
+        }
+
+        llvm::Value *value = expr->codeGen();
+        while (true) {
+            if (!value) {
+                return nullptr;
+            }
+            if (stack.empty()) {
+                return value;
+            }
+
+            auto &top = stack.back();
+            Opcode op = top.binary->op_;
+            if (op == Opcode::ASSIGN) {
+                auto *dest = llvm::dyn_cast<VarAST>(top.binary->lhs_);
+                if (!dest) {
+                    return LogErrorV("Destination of '=' must be a variable");
+                }
+                value = Codegen::assign(dest->getName(), value);
+                stack.pop_back();
+                continue;
+            }
+            if (op == Opcode::AND || op == Opcode::OR) {
+                auto *rhs = top.binary->rhs_;
+                value = Codegen::logical(
+                        op == Opcode::AND,
+                        value,
+                        [rhs] { return rhs->codeGen(); },
+                        !rhs->hasSideEffects());
+                stack.pop_back();
+                continue;
+            }
+            if (!top.lhs) {
+                top.lhs = value;
+                expr = top.binary->rhs_;
+                break;
+            }
+            value = Codegen::binary(op, top.lhs, value);
+            stack.pop_back();
+        }
     }
-    if (op_ == "=") {
-        return Context::IRManager::getBuilder()->CreateStore(rhs, lhs);
-    }
-
-    // default:
-    std::string msg = "invalid binary operator ";
-    msg += op_;
-    msg += ("for " + lhs->getName() + " | " + rhs->getName()).str();
-    return LogErrorV(msg.c_str());
 }
 
 void BinaryExprAST::debugPrint([[ maybe_unused ]] int layer) const
@@ -141,61 +207,180 @@ IFDEBUG({
     ++layer;
     debug(layer, "BinaryOp:");
     lhs_->debugPrint(layer);
-    debug(layer, "OP: ", op_);
+    debug(layer, "OP: ", getSpelling(op_));
     rhs_->debugPrint(layer);
     debug(layer, "End of BinaryOp");
 })
 
-std::string BinaryExprAST::getOp() const
+bool BinaryExprAST::hasSideEffects() const
+{
+    return sideEffects_;
+}
+
+void BinaryExprAST::updateSideEffects()
+{
+    sideEffects_ = hasOwnSideEffects() || lhs_->hasSideEffects() || rhs_->hasSideEffects();
+}
+
+bool BinaryExprAST::hasOwnSideEffects() const
+{
+    // user-defined operators are calls
+    if (op_ == Opcode::ASSIGN || isUserOperator(op_)) {
+        return true;
+    }
+    // division by zero or INT64_MIN / -1 traps
+    if (op_ == Opcode::DIV || op_ == Opcode::MOD) {
+        auto *divisor = llvm::dyn_cast<ValueAST>(rhs_);
+        return !divisor || divisor->getValue() == 0 || divisor->getValue() == -1;
+    }
+    return false;
+}
+
+ExpressionAST *BinaryExprAST::fold(Arena &arena)
+{
+    // post order with an explicit stack, like codeGen()
+    struct Pending {
+        BinaryExprAST *binary;
+        bool lhsFolded = false;
+    };
+    llvm::SmallVector<Pending, 16> stack;
+
+    ExpressionAST *expr = this;
+    while (true) {
+        while (auto *binary = llvm::dyn_cast<BinaryExprAST>(expr)) {
+            stack.push_back({ binary });
+            expr = binary->lhs_;
+        }
+
+        ExpressionAST *folded = expr->fold(arena);
+        while (true) {
+            if (stack.empty()) {
+                return folded;
+            }
+
+            auto &top = stack.back();
+            if (!top.lhsFolded) {
+                top.binary->lhs_ = folded;
+                top.lhsFolded = true;
+                expr = top.binary->rhs_;
+                break;
+            }
+            top.binary->rhs_ = folded;
+            top.binary->updateSideEffects();
+            folded = top.binary->simplify(arena);
+            stack.pop_back();
+        }
+    }
+}
+
+ExpressionAST *BinaryExprAST::simplify(Arena &arena)
+{
+    auto *lhs = llvm::dyn_cast<ValueAST>(lhs_);
+    auto *rhs = llvm::dyn_cast<ValueAST>(rhs_);
+    auto is = [](ValueAST *value, int64_t constant) {
+        return value && value->getValue() == constant;
+    };
+
+    if (op_ == Opcode::AND || op_ == Opcode::OR) {
+        if (!lhs) {
+            return this;
+        }
+        // rhs is never evaluated
+        if ((lhs->getValue() != 0) == (op_ == Opcode::OR)) {
+            return arena.make<ValueAST>(op_ == Opcode::OR);
+        }
+        // rhs decides
+        if (rhs) {
+            return arena.make<ValueAST>(rhs->getValue() != 0);
+        }
+        return arena.make<BinaryExprAST>(Opcode::NOT_EQ, rhs_, arena.make<ValueAST>(0));
+    }
+
+    if (lhs && rhs) {
+        if (auto value = evaluate(op_, lhs->getValue(), rhs->getValue())) {
+            return arena.make<ValueAST>(*value);
+        }
+        return this;
+    }
+
+    switch (op_) {
+        case Opcode::ADD:
+        case Opcode::BIT_OR:
+            if (is(lhs, 0)) {
+                return rhs_;
+            }
+            return is(rhs, 0) ? lhs_ : this;
+
+        case Opcode::SUB:
+            if (auto *var = llvm::dyn_cast<VarAST>(lhs_)) {
+                auto *other = llvm::dyn_cast<VarAST>(rhs_);
+                if (other && other->getName() == var->getName()) {
+                    return arena.make<ValueAST>(0);
+                }
+            }
+            return is(rhs, 0) ? lhs_ : this;
+
+        case Opcode::SHL:
+        case Opcode::SHR:
+            return is(rhs, 0) ? lhs_ : this;
+
+        case Opcode::MUL:
+            if (is(lhs, 1)) {
+                return rhs_;
+            }
+            if (is(rhs, 1)) {
+                return lhs_;
+            }
+            if ((is(lhs, 0) && !rhs_->hasSideEffects())
+                    || (is(rhs, 0) && !lhs_->hasSideEffects())) {
+                return arena.make<ValueAST>(0);
+            }
+            return this;
+
+        case Opcode::DIV:
+            return is(rhs, 1) ? lhs_ : this;
+
+        default:
+            return this;
+    }
+}
+
+Opcode BinaryExprAST::getOpcode() const
 {
     return op_;
 }
 
-llvm::Value *BinaryExprAST::less(llvm::Value *lhs, llvm::Value *rhs) const
+const ExpressionAST *BinaryExprAST::getLHS() const
+{
+    return lhs_;
+}
+
+const ExpressionAST *BinaryExprAST::getRHS() const
 {
-    return Context::IRManager::getBuilder()->CreateIntCast(
-            Context::IRManager::getBuilder()->CreateICmpULT(lhs, rhs, "booltmp"),
-            llvm::Type::getInt64Ty(*Context::IRManager::getCtx()),
-            false);
+    return rhs_;
 }
 
 // Call
 CallExprAST::CallExprAST(
-        std::string callee,
-        std::vector<std::unique_ptr<ExpressionAST>> args)
-    : callee_(std::move(callee)),
-    args_(std::move(args))
+        Symbol::Id callee,
+        std::span<ExpressionAST *> args)
+    : ExpressionAST(Kind::CALL),
+    callee_(callee),
+    args_(args)
 { }
 
 llvm::Value *CallExprAST::codeGen() const
 {
-    llvm::Function *calleeF = findFunction(callee_);
-    if (!calleeF) {
-        std::string msg = "Unknown function reference " + callee_;
-        return LogErrorV(msg.c_str());
-    }
-    if (calleeF->arg_size() != args_.size()) {
-        std::string msg = "Incorrect incorrect number of arguments passed for " + callee_;
-        return LogErrorV(msg.c_str());
-    }
-
-    std::vector<llvm::Value *> argsValues;
-    for (size_t i = 0; i != args_.size(); ++i) {
-        argsValues.push_back(args_[i]->codeGen());
-        if (!argsValues.back())
-            return nullptr;
-    }
-
-    return Context::IRManager::getBuilder()->CreateCall(
-            calleeF,
-            argsValues,
-            "calltmp");
+    return Codegen::call(
+            callee_,
+            args_.size(),
+            [this](size_t i) { return args_[i]->codeGen(); });
 }
 
 void CallExprAST::debugPrint([[ maybe_unused ]] int layer) const
 IFDEBUG({
     ++layer;
-    debug(layer, "Call: ", callee_);
+    debug(layer, "Call: ", Symbol::name(callee_));
     for (size_t i = 0; i < args_.size(); ++i) {
         debug(layer, "Arg: ", i);
         args_[i]->debugPrint(layer);
@@ -203,19 +388,49 @@ IFDEBUG({
     debug(layer, "End of Call");
 })
 
+bool CallExprAST::hasSideEffects() const
+{
+    return true;
+}
+
+ExpressionAST *CallExprAST::fold(Arena &arena)
+{
+    for (auto &arg : args_) {
+        arg = arg->fold(arena);
+    }
+    return this;
+}
+
+Symbol::Id CallExprAST::getCallee() const
+{
+    return callee_;
+}
+
+std::span<ExpressionAST * const> CallExprAST::getArgs() const
+{
+    return args_;
+}
+
 // Prototype
 PrototypeAST::PrototypeAST(
-        std::string name,
-        std::vector<std::string> args)
-    : name_(std::move(name)),
-    args_(std::move(args))
+        Symbol::Id name,
+        std::vector<Symbol::Id> args,
+        int precedence)
+    : name_(name),
+    args_(std::move(args)),
+    precedence_(precedence)
 { }
 
-const std::string &PrototypeAST::getName() const
+Symbol::Id PrototypeAST::getName() const
 {
     return name_;
 }
 
+const std::vector<Symbol::Id> &PrototypeAST::getArgs() const
+{
+    return args_;
+}
+
 llvm::Function *PrototypeAST::codeGen() const
 {
     std::vector<llvm::Type *> argsTypes(args_.size(), getType());
@@ -224,22 +439,29 @@ llvm::Function *PrototypeAST::codeGen() const
         llvm::Function::Create(
             llvm::FunctionType::get(getType(), argsTypes, false),
             llvm::Function::ExternalLinkage,
-            name_,
+            Symbol::name(name_),
             Context::IRManager::getModule());
 
     for (auto arg : std::views::zip(func->args(), args_)) {
-        std::get<0>(arg).setName(std::get<1>(arg));
+        std::get<0>(arg).setName(Symbol::name(std::get<1>(arg)));
     }
 
     return func;
 }
 
+void PrototypeAST::registerOperator() const
+{
+    if (precedence_ > 0) {
+        defineOperator(Symbol::name(name_).back(), precedence_);
+    }
+}
+
 void PrototypeAST::debugPrint([[ maybe_unused ]] int layer) const
 IFDEBUG({
     ++layer;
-    debug(layer, "Proto: ", name_);
+    debug(layer, "Proto: ", Symbol::name(name_));
     for (size_t i = 0; i < args_.size(); ++i) {
-        debug(layer, "Arg: ", i, " - ", args_[i]);
+        debug(layer, "Arg: ", i, " - ", Symbol::name(args_[i]));
     }
     debug(layer, "End of Proto");
 })
@@ -247,11 +469,41 @@ IFDEBUG({
 // Function
 FunctionAST::FunctionAST(
         std::unique_ptr<PrototypeAST> proto,
-        std::unique_ptr<ExpressionAST> body)
+        ExpressionAST *body,
+        bool resolved,
+        std::vector<std::pair<Symbol::Id, size_t>> calls)
     : proto_(std::move(proto)),
-    body_(std::move(body))
+    body_(body),
+    resolved_(resolved),
+    calls_(std::move(calls))
 { }
 
+void FunctionAST::fold(Arena &arena)
+{
+    if (!resolved_) {
+        return;
+    }
+
+    // what findFunction() will see, the function itself included
+    auto &protos = Context::IRManager::getFunctionProtos();
+    for (auto [callee, argCount] : calls_) {
+        const PrototypeAST *known = proto_.get();
+        if (callee != proto_->getName()) {
+            auto it = protos.find(callee);
+            known = it != protos.end() ? it->second.get() : nullptr;
+        }
+        if (!known || known->getArgs().size() != argCount) {
+            return;
+        }
+    }
+    body_ = body_->fold(arena);
+}
+
+const ExpressionAST *FunctionAST::getBody() const
+{
+    return body_;
+}
+
 llvm::Function *FunctionAST::codeGen()
 {
     auto &protoPtr = *proto_;
@@ -267,15 +519,18 @@ llvm::Function *FunctionAST::codeGen()
             "entry",
             func));
 
-    Context::IRManager::getValues().clear();
-    for (auto &arg : func->args()) {
-        Context::IRManager::getValues()[std::string(arg.getName())] = &arg;
+    // arguments are locals too
+    Context::Scope scope(Context::IRManager::getEnv());
+    for (auto arg : std::views::zip(func->args(), protoPtr.getArgs())) {
+        Codegen::declare(std::get<1>(arg), &std::get<0>(arg));
     }
 
-    if (llvm::Value *retVal = body_->codeGen()) {
+    llvm::Value *retVal = body_->codeGen();
+    if (retVal) {
         Context::IRManager::getBuilder()->CreateRet(retVal);
         llvm::verifyFunction(*func);
-        Context::IRManager::getFPM()->run(*func, *Context::IRManager::getFAM());
+        Context::IRManager::optimize();
+        protoPtr.registerOperator();
         return func;
     }
 
@@ -286,24 +541,25 @@ llvm::Function *FunctionAST::codeGen()
 void FunctionAST::debugPrint([[ maybe_unused ]] int layer) const
 IFDEBUG({
     ++layer;
-    if (!proto_->getName().empty()) { // top layer
-        debug(layer, "Func: ", proto_->getName());
+    if (!Symbol::name(proto_->getName()).empty()) { // top layer
+        debug(layer, "Func: ", Symbol::name(proto_->getName()));
         proto_->debugPrint(layer);
     }
     body_->debugPrint(layer);
-    if (!proto_->getName().empty()) {
+    if (!Symbol::name(proto_->getName()).empty()) {
         debug(layer, "End of Func");
     }
 })
 
 // If/Else
 IfElseExpressionAST::IfElseExpressionAST(
-        std::unique_ptr<ExpressionAST> condExpr,
-        std::unique_ptr<ExpressionAST> thenExpr,
-        std::unique_ptr<ExpressionAST> elseExpr)
-    : condExpr_(std::move(condExpr)),
-      thenExpr_(std::move(thenExpr)),
-      elseExpr_(std::move(elseExpr))
+        ExpressionAST *condExpr,
+        ExpressionAST *thenExpr,
+        ExpressionAST *elseExpr)
+    : ExpressionAST(Kind::IF_ELSE),
+      condExpr_(condExpr),
+      thenExpr_(thenExpr),
+      elseExpr_(elseExpr)
 { }
 
 llvm::Value *IfElseExpressionAST::codeGen() const
@@ -313,60 +569,10 @@ llvm::Value *IfElseExpressionAST::codeGen() const
         return nullptr;
     }
 
-    auto rhs = llvm::ConstantInt::get(
-            *Context::IRManager::getCtx(),
-            llvm::APInt(64, 0));
-
-    Context::IRManager::getBuilder()->CreateICmpULT(condValue, rhs, "booltmp");
-
-    condValue = Context::IRManager::getBuilder()->CreateICmpNE(
-        condValue,
-        rhs,
-        "ifcond");
-
-    llvm::Function *func = Context::IRManager::getBuilder()->GetInsertBlock()->getParent();
-
-    llvm::BasicBlock *thenBB =
-        llvm::BasicBlock::Create(*Context::IRManager::getCtx(), "then", func);
-    llvm::BasicBlock *elseBB =
-        llvm::BasicBlock::Create(*Context::IRManager::getCtx(), "else");
-    llvm::BasicBlock *mergeBB =
-        llvm::BasicBlock::Create(*Context::IRManager::getCtx(), "ifcont");
-
-    Context::IRManager::getBuilder()->CreateCondBr(condValue, thenBB, elseBB);
-
-    Context::IRManager::getBuilder()->SetInsertPoint(thenBB);
-
-    llvm::Value *thenValue = thenExpr_->codeGen();
-    if (!thenValue) {
-        return nullptr;
-    }
-
-    Context::IRManager::getBuilder()->CreateBr(mergeBB);
-    thenBB = Context::IRManager::getBuilder()->GetInsertBlock();
-
-    func->insert(func->end(), elseBB);
-    Context::IRManager::getBuilder()->SetInsertPoint(elseBB);
-
-    llvm::Value *elseValue = elseExpr_->codeGen();
-    if (!elseValue) {
-        return nullptr;
-    }
-
-    Context::IRManager::getBuilder()->CreateBr(mergeBB);
-    elseBB = Context::IRManager::getBuilder()->GetInsertBlock();
-
-    func->insert(func->end(), mergeBB);
-    Context::IRManager::getBuilder()->SetInsertPoint(mergeBB);
-    llvm::PHINode *phiNode =
-        Context::IRManager::getBuilder()->CreatePHI(
-            llvm::Type::getInt64Ty(*Context::IRManager::getCtx()),
-            2,
-            "iftmp");
-
-    phiNode->addIncoming(thenValue, thenBB);
-    phiNode->addIncoming(elseValue, elseBB);
-    return phiNode;
+    return Codegen::ifElse(
+            condValue,
+            [this] { return thenExpr_->codeGen(); },
+            [this] { return elseExpr_->codeGen(); });
 }
 
 void IfElseExpressionAST::debugPrint([[ maybe_unused ]] int layer) const
@@ -382,18 +588,52 @@ IFDEBUG({
     }
 })
 
+bool IfElseExpressionAST::hasSideEffects() const
+{
+    return condExpr_->hasSideEffects()
+        || thenExpr_->hasSideEffects()
+        || (elseExpr_ && elseExpr_->hasSideEffects());
+}
+
+ExpressionAST *IfElseExpressionAST::fold(Arena &arena)
+{
+    condExpr_ = condExpr_->fold(arena);
+    if (auto *cond = llvm::dyn_cast<ValueAST>(condExpr_)) {
+        return cond->getValue() ? thenExpr_->fold(arena) : elseExpr_->fold(arena);
+    }
+    thenExpr_ = thenExpr_->fold(arena);
+    elseExpr_ = elseExpr_->fold(arena);
+    return this;
+}
+
+const ExpressionAST *IfElseExpressionAST::getCond() const
+{
+    return condExpr_;
+}
+
+const ExpressionAST *IfElseExpressionAST::getThen() const
+{
+    return thenExpr_;
+}
+
+const ExpressionAST *IfElseExpressionAST::getElse() const
+{
+    return elseExpr_;
+}
+
 // for
 ForExpressionAST::ForExpressionAST(
-        std::string varName,
-        std::unique_ptr<ExpressionAST> start,
-        std::unique_ptr<ExpressionAST> end,
-        std::unique_ptr<ExpressionAST> step,
-        std::unique_ptr<ExpressionAST> body_)
-    : iterName_(std::move(varName)),
-      start_(std::move(start)),
-      end_(std::move(end)),
-      step_(std::move(step)),
-      body_(std::move(body_))
+        Symbol::Id varName,
+        ExpressionAST *start,
+        ExpressionAST *end,
+        ExpressionAST *step,
+        ExpressionAST *body_)
+    : ExpressionAST(Kind::FOR),
+      iterName_(varName),
+      start_(start),
+      end_(end),
+      step_(step),
+      body_(body_)
 { }
 
 llvm::Value *ForExpressionAST::codeGen() const
@@ -403,86 +643,140 @@ llvm::Value *ForExpressionAST::codeGen() const
         return nullptr;
     }
 
-    llvm::Function *func = Context::IRManager::getBuilder()->GetInsertBlock()->getParent();
-    llvm::BasicBlock *preHeaderBB = Context::IRManager::getBuilder()->GetInsertBlock();
-    llvm::BasicBlock *loopBB = llvm::BasicBlock::Create(
-        *Context::IRManager::getCtx(),
-        "loop",
-        func);
-
-    Context::IRManager::getBuilder()->CreateBr(loopBB);
-    Context::IRManager::getBuilder()->SetInsertPoint(loopBB);
-
-    llvm::PHINode *iter = Context::IRManager::getBuilder()->CreatePHI(
-        llvm::Type::getInt64Ty(*Context::IRManager::getCtx()),
-        2,
-        iterName_);
-
-    iter->addIncoming(startVal, preHeaderBB);
-
-    llvm::Value *oldIter = Context::IRManager::getValues()[iterName_];
-    Context::IRManager::getValues()[iterName_] = iter;
+    return Codegen::forLoop(
+            iterName_,
+            startVal,
+            [this] { return end_->codeGen(); },
+            step_ ? Codegen::Emit([this] { return step_->codeGen(); }) : Codegen::Emit(),
+            [this] { return body_->codeGen(); });
+}
 
-    if (!body_->codeGen()) {
-        return nullptr;
+void ForExpressionAST::debugPrint([[ maybe_unused ]] int layer) const
+IFDEBUG({
+    ++layer;
+    debug(layer, "For ", Symbol::name(iterName_), " = ");
+    start_->debugPrint();
+    debug(layer, "End:");
+    end_->debugPrint();
+    if (step_) {
+        debug(layer, "Step:");
+        step_->debugPrint();
     }
+    debug(layer + 1, "Body:");
+    body_->debugPrint();
+})
+
+bool ForExpressionAST::hasSideEffects() const
+{
+    // may not terminate
+    return true;
+}
 
-    llvm::Value *stepVal = nullptr;
+ExpressionAST *ForExpressionAST::fold(Arena &arena)
+{
+    start_ = start_->fold(arena);
+    end_ = end_->fold(arena);
     if (step_) {
-        stepVal = step_->codeGen();
-    } else {
-        stepVal = llvm::ConstantInt::get(*Context::IRManager::getCtx(), llvm::APInt(64, 1.0));
+        step_ = step_->fold(arena);
     }
-    if (!stepVal) {
-        return nullptr;
+    body_ = body_->fold(arena);
+
+    // never entered with a constant false condition
+    auto *end = llvm::dyn_cast<ValueAST>(end_);
+    if (end && end->getValue() == 0 && !start_->hasSideEffects()) {
+        return arena.make<ValueAST>(0);
     }
+    return this;
+}
 
-    llvm::Value *nextIter = Context::IRManager::getBuilder()->CreateAdd(iter, stepVal, "nextvar");
+Symbol::Id ForExpressionAST::getIterName() const
+{
+    return iterName_;
+}
 
-    llvm::Value *endCond = end_->codeGen();
-    if (!endCond) {
-        return nullptr;
-    }
+const ExpressionAST *ForExpressionAST::getStart() const
+{
+    return start_;
+}
 
-    endCond = Context::IRManager::getBuilder()->CreateICmpNE(
-            endCond,
-            llvm::ConstantInt::get(*Context::IRManager::getCtx(), llvm::APInt(64, 0.0)),
-            "loopcond");
+const ExpressionAST *ForExpressionAST::getEnd() const
+{
+    return end_;
+}
 
-    llvm::BasicBlock *loopEndBB = Context::IRManager::getBuilder()->GetInsertBlock();
-    llvm::BasicBlock *afterBB =
-        llvm::BasicBlock::Create(
-            *Context::IRManager::getCtx(),
-            "afterloop",
-            func);
+const ExpressionAST *ForExpressionAST::getStep() const
+{
+    return step_;
+}
 
-    Context::IRManager::getBuilder()->CreateCondBr(endCond, loopBB, afterBB);
-    Context::IRManager::getBuilder()->SetInsertPoint(afterBB);
-    iter->addIncoming(nextIter, loopEndBB);
+const ExpressionAST *ForExpressionAST::getBody() const
+{
+    return body_;
+}
 
-    if (oldIter) {
-        Context::IRManager::getValues()[iterName_] = oldIter;
-    }
-    else {
-        Context::IRManager::getValues().erase(iterName_);
-    }
+// var/in
+VarInExpressionAST::VarInExpressionAST(
+        std::span<Symbol::Id> names,
+        std::span<ExpressionAST *> inits,
+        ExpressionAST *body)
+    : ExpressionAST(Kind::VAR_IN),
+      names_(names),
+      inits_(inits),
+      body_(body)
+{ }
 
-    return llvm::Constant::getNullValue(llvm::Type::getDoubleTy(*Context::IRManager::getCtx()));
+llvm::Value *VarInExpressionAST::codeGen() const
+{
+    return Codegen::varIn(
+            names_,
+            [this](size_t i) { return inits_[i]->codeGen(); },
+            [this] { return body_->codeGen(); });
 }
 
-void ForExpressionAST::debugPrint([[ maybe_unused ]] int layer) const
+void VarInExpressionAST::debugPrint([[ maybe_unused ]] int layer) const
 IFDEBUG({
     ++layer;
-    debug(layer, "For ", iterName_, " = ");
-    start_->debugPrint();
-    debug(layer, "End:");
-    end_->debugPrint();
-    if (step_) {
-        debug(layer, "Step:");
-        step_->debugPrint();
+    debug(layer, "Var:");
+    for (size_t i = 0; i < names_.size(); ++i) {
+        debug(layer, Symbol::name(names_[i]), " = ");
+        inits_[i]->debugPrint(layer);
     }
-    debug(layer + 1, "Body:");
-    body_->debugPrint();
+    debug(layer, "In:");
+    body_->debugPrint(layer);
 })
 
+bool VarInExpressionAST::hasSideEffects() const
+{
+    for (auto *init : inits_) {
+        if (init->hasSideEffects()) {
+            return true;
+        }
+    }
+    return body_->hasSideEffects();
+}
+
+ExpressionAST *VarInExpressionAST::fold(Arena &arena)
+{
+    for (auto &init : inits_) {
+        init = init->fold(arena);
+    }
+    body_ = body_->fold(arena);
+    return this;
+}
+
+std::span<const Symbol::Id> VarInExpressionAST::getNames() const
+{
+    return names_;
+}
+
+std::span<ExpressionAST * const> VarInExpressionAST::getInits() const
+{
+    return inits_;
+}
+
+const ExpressionAST *VarInExpressionAST::getBody() const
+{
+    return body_;
+}
+
 } // namespace AST
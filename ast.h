@@ -1,24 +1,61 @@
 #pragma once
 
+#include "arena.h"
 #include "context.h"
 #include "debug.h"
+#include "opcode.h"
+#include "symbol.h"
 
 #include "llvm/IR/Value.h"
+#include "llvm/Support/Casting.h"
 
 #include <cstdint>
+#include <span>
 #include <string>
+#include <string_view>
+#include <utility>
 
 
 namespace AST {
 
-llvm::Function *findFunction(std::string name);
+llvm::Function *findFunction(Symbol::Id name);
 
 class ExpressionAST {
 public:
+    // discriminator for llvm::isa/dyn_cast
+    enum class Kind : uint8_t {
+        VALUE,
+        VAR,
+        BINARY,
+        CALL,
+        IF_ELSE,
+        FOR,
+        VAR_IN,
+    };
+
+    Kind getKind() const { return kind_; }
+
     virtual llvm::Value *codeGen() const         = 0;
     virtual void debugPrint(int layer = 0) const = 0;
 
-    virtual ~ExpressionAST() = default;
+    // side effects or possible traps,
+    // false if the expression is safe to evaluate speculatively
+    virtual bool hasSideEffects() const          = 0;
+
+    // Folds constants and trivial identities of the subtree in place.
+    // Returns the node to use instead, this one or a new one from `arena`.
+    virtual ExpressionAST *fold(Arena &arena)    = 0;
+
+protected:
+    explicit ExpressionAST(Kind kind)
+        : kind_(kind)
+    { }
+
+    // nodes live in an Arena and are never destroyed one by one
+    ~ExpressionAST() = default;
+
+private:
+    const Kind kind_;
 };
 
 // Values
@@ -31,20 +68,42 @@ public:
 
     void debugPrint(int layer = 0) const override;
 
+    bool hasSideEffects() const override;
+
+    ExpressionAST *fold(Arena &arena) override;
+
+    static bool classof(const ExpressionAST *expr)
+    {
+        return expr->getKind() == Kind::VALUE;
+    }
+
+    int64_t getValue() const;
+
 private:
     int64_t value_;
 };
 
 class VarAST : public ExpressionAST {
 public:
-    VarAST(std::string name);
+    VarAST(Symbol::Id name);
 
     llvm::Value *codeGen() const override;
 
     void debugPrint(int layer = 0) const override;
 
+    bool hasSideEffects() const override;
+
+    ExpressionAST *fold(Arena &arena) override;
+
+    static bool classof(const ExpressionAST *expr)
+    {
+        return expr->getKind() == Kind::VAR;
+    }
+
+    Symbol::Id getName() const;
+
 private:
-    std::string name_;
+    Symbol::Id name_;
 };
 
 // Operators
@@ -52,21 +111,44 @@ private:
 class BinaryExprAST : public ExpressionAST {
 public:
     BinaryExprAST(
-            std::string op,
-            std::unique_ptr<ExpressionAST> lhs,
-            std::unique_ptr<ExpressionAST> rhs);
+            Opcode op,
+            ExpressionAST *lhs,
+            ExpressionAST *rhs);
 
     llvm::Value *codeGen() const override;
 
     void debugPrint([[ maybe_unused ]] int layer = 0) const override;
 
-    std::string getOp() const;
+    bool hasSideEffects() const override;
+
+    ExpressionAST *fold(Arena &arena) override;
+
+    static bool classof(const ExpressionAST *expr)
+    {
+        return expr->getKind() == Kind::BINARY;
+    }
+
+    Opcode getOpcode() const;
+
+    const ExpressionAST *getLHS() const;
+
+    const ExpressionAST *getRHS() const;
 
 private:
-    llvm::Value *less(llvm::Value *lhs, llvm::Value *rhs) const;
+    // of the operator itself, operands aside
+    bool hasOwnSideEffects() const;
+
+    // sets sideEffects_ from the operands, theirs are cached already
+    void updateSideEffects();
+
+    // folds this node, its operands are folded already
+    ExpressionAST *simplify(Arena &arena);
+
+    Opcode op_;
+    ExpressionAST *lhs_, *rhs_;
 
-    std::string op_;
-    std::unique_ptr<ExpressionAST> lhs_, rhs_;
+    // set once the operands are known, so checks of long chains stay linear
+    bool sideEffects_ = true;
 };
 
 // Functions
@@ -74,28 +156,48 @@ private:
 class CallExprAST : public ExpressionAST {
 public:
     CallExprAST(
-            std::string callee,
-            std::vector<std::unique_ptr<ExpressionAST>> args);
+            Symbol::Id callee,
+            std::span<ExpressionAST *> args);
 
     llvm::Value *codeGen() const override;
 
     void debugPrint(int layer = 0) const override;
 
+    bool hasSideEffects() const override;
+
+    ExpressionAST *fold(Arena &arena) override;
+
+    static bool classof(const ExpressionAST *expr)
+    {
+        return expr->getKind() == Kind::CALL;
+    }
+
+    Symbol::Id getCallee() const;
+
+    std::span<ExpressionAST * const> getArgs() const;
+
 private:
-    std::string callee_;
-    std::vector<std::unique_ptr<ExpressionAST>> args_;
+    Symbol::Id callee_;
+    std::span<ExpressionAST *> args_;
 };
 
 class PrototypeAST {
 public:
+    // `precedence` of the operator a 'binary' prototype defines, 0 otherwise
     PrototypeAST(
-            std::string name,
-            std::vector<std::string> args);
+            Symbol::Id name,
+            std::vector<Symbol::Id> args,
+            int precedence = 0);
 
-    const std::string &getName() const;
+    Symbol::Id getName() const;
+
+    const std::vector<Symbol::Id> &getArgs() const;
 
     llvm::Function *codeGen() const;
 
+    // makes the operator usable, called once its function is generated
+    void registerOperator() const;
+
     void debugPrint(int layer = 0) const;
 
 private:
@@ -104,15 +206,27 @@ private:
         return llvm::Type::getInt64Ty(*Context::IRManager::getCtx());
     }
 
-    std::string name_;
-    std::vector<std::string> args_;
+    Symbol::Id name_;
+    std::vector<Symbol::Id> args_;
+    int precedence_;
 };
 
 class FunctionAST {
 public:
+    // `resolved` if every variable of the body is in scope,
+    // `calls` are its callees with their argument counts
     FunctionAST(
             std::unique_ptr<PrototypeAST> proto,
-            std::unique_ptr<ExpressionAST> body);
+            ExpressionAST *body,
+            bool resolved,
+            std::vector<std::pair<Symbol::Id, size_t>> calls);
+
+    // Folds the body unless it names a variable or a function codegen
+    // would reject: folding could drop it and hide the error. Functions
+    // are looked up when the item is handled, so in source order.
+    void fold(Arena &arena);
+
+    const ExpressionAST *getBody() const;
 
     llvm::Function *codeGen();
 
@@ -120,52 +234,124 @@ public:
 
 private:
     std::unique_ptr<PrototypeAST> proto_;
-    std::unique_ptr<ExpressionAST> body_;
+    ExpressionAST *body_;
+    bool resolved_;
+    std::vector<std::pair<Symbol::Id, size_t>> calls_;
 };
 
 // Statements
 class IfElseExpressionAST : public ExpressionAST {
 public:
     IfElseExpressionAST(
-        std::unique_ptr<ExpressionAST> condExpr,
-        std::unique_ptr<ExpressionAST> thenExpr,
-        std::unique_ptr<ExpressionAST> elseExpr);
+        ExpressionAST *condExpr,
+        ExpressionAST *thenExpr,
+        ExpressionAST *elseExpr);
 
     llvm::Value *codeGen() const override;
 
     void debugPrint(int layer = 0) const override;
 
+    bool hasSideEffects() const override;
+
+    ExpressionAST *fold(Arena &arena) override;
+
+    static bool classof(const ExpressionAST *expr)
+    {
+        return expr->getKind() == Kind::IF_ELSE;
+    }
+
+    const ExpressionAST *getCond() const;
+
+    const ExpressionAST *getThen() const;
+
+    const ExpressionAST *getElse() const;
+
 private:
-    std::unique_ptr<ExpressionAST> condExpr_;
-    std::unique_ptr<ExpressionAST> thenExpr_;
-    std::unique_ptr<ExpressionAST> elseExpr_;
+    ExpressionAST *condExpr_;
+    ExpressionAST *thenExpr_;
+    ExpressionAST *elseExpr_;
 };
 
 class ForExpressionAST : public ExpressionAST {
 public:
     ForExpressionAST(
-        std::string varName,
-        std::unique_ptr<ExpressionAST> start,
-        std::unique_ptr<ExpressionAST> end,
-        std::unique_ptr<ExpressionAST> step,
-        std::unique_ptr<ExpressionAST> body_);
+        Symbol::Id varName,
+        ExpressionAST *start,
+        ExpressionAST *end,
+        ExpressionAST *step,
+        ExpressionAST *body_);
 
     llvm::Value *codeGen() const override;
 
     void debugPrint(int layer = 0) const override;
 
+    bool hasSideEffects() const override;
+
+    ExpressionAST *fold(Arena &arena) override;
+
+    static bool classof(const ExpressionAST *expr)
+    {
+        return expr->getKind() == Kind::FOR;
+    }
+
+    Symbol::Id getIterName() const;
+
+    const ExpressionAST *getStart() const;
+
+    const ExpressionAST *getEnd() const;
+
+    // nullptr for the default step of 1
+    const ExpressionAST *getStep() const;
+
+    const ExpressionAST *getBody() const;
+
+private:
+    Symbol::Id iterName_;
+    ExpressionAST *start_;
+    ExpressionAST *end_;
+    ExpressionAST *step_;
+    ExpressionAST *body_;
+};
+
+class VarInExpressionAST : public ExpressionAST {
+public:
+    VarInExpressionAST(
+        std::span<Symbol::Id> names,
+        std::span<ExpressionAST *> inits,
+        ExpressionAST *body);
+
+    llvm::Value *codeGen() const override;
+
+    void debugPrint(int layer = 0) const override;
+
+    bool hasSideEffects() const override;
+
+    ExpressionAST *fold(Arena &arena) override;
+
+    static bool classof(const ExpressionAST *expr)
+    {
+        return expr->getKind() == Kind::VAR_IN;
+    }
+
+    std::span<const Symbol::Id> getNames() const;
+
+    // one per name
+    std::span<ExpressionAST * const> getInits() const;
+
+    const ExpressionAST *getBody() const;
+
 private:
-    std::string iterName_;
-    std::unique_ptr<ExpressionAST> start_;
-    std::unique_ptr<ExpressionAST> end_;
-    std::unique_ptr<ExpressionAST> step_;
-    std::unique_ptr<ExpressionAST> body_;
+    std::span<Symbol::Id> names_;
+    std::span<ExpressionAST *> inits_;
+    ExpressionAST *body_;
 };
 
 
 // Loggers
 
-std::unique_ptr<ExpressionAST> LogError(const char *Str);
+ExpressionAST *LogError(const char *Str);
+// errors of the calling thread are appended to `sink` instead, nullptr restores stderr
+void redirectErrors(std::string *sink);
 llvm::Value *LogErrorV(const char *str);
 std::unique_ptr<PrototypeAST> LogErrorP(const char *str);
 std::unique_ptr<FunctionAST> LogErrorF(const char *str);
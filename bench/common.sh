@@ -0,0 +1,36 @@
+# Harness shared by the benchmarks, sourced after MAIN is set.
+# Scripts write their program to $INPUT and print rows with run_timed.
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+INPUT="$TMP/input.shit"
+
+# Runs MAIN with the arguments on $INPUT and prints `label` followed by the
+# seconds it took, and by the peak number of mappings of the process when
+# SAMPLE_MAPPINGS is set. Prints "failed" instead if MAIN fails.
+#
+# usage: run_timed "<label>" [main args...]
+run_timed() {
+    local label=$1
+    shift
+
+    local start=$(date +%s.%N)
+    "$MAIN" "$@" "$INPUT" > /dev/null 2>&1 &
+    local pid=$! peak=0
+    if [ -n "$SAMPLE_MAPPINGS" ]; then
+        while kill -0 $pid 2> /dev/null; do
+            local maps=$(wc -l < /proc/$pid/maps 2> /dev/null || echo 0)
+            (( maps > peak )) && peak=$maps
+            sleep 0.05
+        done
+    fi
+    if ! wait $pid; then
+        printf "%s %10s\n" "$label" failed
+        return 1
+    fi
+    local end=$(date +%s.%N)
+
+    printf "%s %10.3f" "$label" $(awk "BEGIN { print $end - $start }")
+    [ -n "$SAMPLE_MAPPINGS" ] && printf " %10d" $peak
+    printf "\n"
+}
@@ -0,0 +1,52 @@
+#!/bin/bash
+
+# Parses and compiles one function with an N-term expression for growing N
+# under a small native stack. Time should grow linearly with N.
+#
+# usage: bench/deep_expressions.sh [./main] [max terms]
+
+MAIN=${1:-./main}
+MAX_TERMS=${2:-1000000}
+STACK_KB=1024
+
+. "$(dirname "$0")/common.sh"
+
+# x + x * 3 - x + ...
+chain() {
+    awk -v n="$1" 'BEGIN {
+        ops[0] = " + "; ops[1] = " * 3 - "
+        printf "fun f(x) x"
+        for (i = 1; i < n; ++i) printf "%sx", ops[i % 2]
+        print ";"
+    }'
+}
+
+# x + (x + (x + ...))
+nested() {
+    awk -v n="$1" 'BEGIN {
+        printf "fun f(x) "
+        for (i = 1; i < n; ++i) printf "x + ("
+        printf "x"
+        for (i = 1; i < n; ++i) printf ")"
+        print ";"
+    }'
+}
+
+# ((((x))))
+parens() {
+    awk -v n="$1" 'BEGIN {
+        printf "fun f(x) "
+        for (i = 0; i < n; ++i) printf "("
+        printf "x"
+        for (i = 0; i < n; ++i) printf ")"
+        print ";"
+    }'
+}
+
+printf "%-8s %10s %10s\n" shape terms seconds
+for shape in chain nested parens; do
+    for (( terms = 10000; terms <= MAX_TERMS; terms *= 10 )); do
+        $shape $terms > "$INPUT"
+        ( ulimit -s $STACK_KB; run_timed "$(printf "%-8s %10d" $shape $terms)" )
+    done
+done
@@ -0,0 +1,24 @@
+#!/bin/bash
+
+# REPL-like workload: N small definitions, each followed by a top-level call
+# whose module is removed after it runs. Reports time and the peak number of
+# mappings of the process for every huge page mode.
+#
+# usage: bench/jit_memory.sh [./main] [definitions]
+
+MAIN=${1:-./main}
+DEFINITIONS=${2:-4000}
+
+. "$(dirname "$0")/common.sh"
+
+awk -v n="$DEFINITIONS" 'BEGIN {
+    for (i = 0; i < n; ++i) {
+        printf "fun f%d(x) x * %d + 1;\n", i, i
+        printf "f%d(%d);\n", i, i
+    }
+}' > "$INPUT"
+
+printf "%-12s %10s %10s\n" "huge pages" seconds mappings
+for pages in none transparent explicit; do
+    SAMPLE_MAPPINGS=1 run_timed "$(printf "%-12s" $pages)" -O0 --no-lazy --jobs 1 --huge-pages $pages
+done
@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# Defines N functions and calls one of them, with and without lazy
+# compilation. Lazy runs should only pay for the functions that get called.
+#
+# usage: bench/lazy_startup.sh [./main] [max functions]
+
+MAIN=${1:-./main}
+MAX_FUNCTIONS=${2:-10000}
+
+. "$(dirname "$0")/common.sh"
+
+# every function calls the previous one, only the last three are reached
+program() {
+    awk -v n="$1" 'BEGIN {
+        print "fun f0(x) x;"
+        for (i = 1; i < n; ++i)
+            printf "fun f%d(x) if x < 1: x * %d else f%d(x - 1) + %d;\n", i, i, i - 1, i
+        printf "f%d(2);\n", n - 1
+    }'
+}
+
+printf "%-8s %10s %10s\n" mode functions seconds
+for (( functions = 100; functions <= MAX_FUNCTIONS; functions *= 10 )); do
+    program $functions > "$INPUT"
+    run_timed "$(printf "%-8s %10d" lazy $functions)"
+    run_timed "$(printf "%-8s %10d" eager $functions)" --no-lazy
+done
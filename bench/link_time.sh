@@ -0,0 +1,36 @@
+#!/bin/bash
+
+# REPL-like workload: N top-level expressions, each its own small module
+# with no symbols from other modules, so no link waits on another one.
+# Compares the time RuntimeDyld and JITLink spend linking each object, as
+# timed by the JIT from the object reaching the object layer to its emission.
+#
+# usage: bench/link_time.sh [./main] [max modules]
+
+MAIN=${1:-./main}
+MAX_MODULES=${2:-8000}
+
+. "$(dirname "$0")/common.sh"
+
+program() {
+    awk -v n="$1" 'BEGIN {
+        for (i = 0; i < n; ++i) printf "var x = %d in x * 3 + x;\n", i
+    }'
+}
+
+printf "%-8s %10s %10s %14s\n" linker objects "link ms" "us per object"
+for (( modules = 1000; modules <= MAX_MODULES; modules *= 2 )); do
+    program $modules > "$INPUT"
+    for linker in rtdyld jitlink; do
+        flags="-O0 --no-lazy --jobs 1 --link-stats"
+        [ $linker = jitlink ] && flags="$flags --jitlink"
+        # JIT linked <objects> objects in <ms> ms, <us> us per object
+        stats=$("$MAIN" $flags "$INPUT" 2>&1 > /dev/null | grep "^JIT linked")
+        if [ -z "$stats" ]; then
+            printf "%-8s %10d %10s\n" $linker $modules failed
+            continue
+        fi
+        read -r _ _ objects _ _ ms _ us _ <<< "$stats"
+        printf "%-8s %10d %10.1f %14.1f\n" $linker $objects $ms $us
+    done
+done
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Parses a file big enough to be split into chunks that uses an operator
+# before defining it and then redefines it with another precedence, with one
+# job and with many. Both runs must print the same.
+#
+# usage: bench/operator_chunks.sh [./main] [jobs]
+
+MAIN=${1:-./main}
+JOBS=${2:-4}
+
+. "$(dirname "$0")/common.sh"
+
+awk 'BEGIN {
+    print "fun g(a, b) a @ b;"
+    for (i = 0; i < 3000; ++i) printf "fun h%d(x) x + %d * 2 - 1;\n", i, i
+    print "fun binary@ 5 (a, b) a - b;"
+    print "1 @ 2 * 3;"
+    for (i = 0; i < 3000; ++i) printf "fun k%d(x) x * %d + 3;\n", i, i
+    print "fun binary@ 60 (a, b) a - b;"
+    print "1 @ 2 * 3;"
+}' > "$INPUT"
+
+"$MAIN" --jobs 1 "$INPUT" > "$TMP/sequential.txt" 2>&1
+"$MAIN" --jobs $JOBS "$INPUT" > "$TMP/chunked.txt" 2>&1
+if ! cmp -s "$TMP/sequential.txt" "$TMP/chunked.txt"; then
+    echo "--jobs $JOBS parses differently from --jobs 1"
+    diff "$TMP/sequential.txt" "$TMP/chunked.txt" | head -20
+    exit 1
+fi
+echo "same output with --jobs 1 and --jobs $JOBS"
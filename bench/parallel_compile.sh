@@ -0,0 +1,32 @@
+#!/bin/bash
+
+# Defines N independent functions and calls all of them from one top-level
+# expression, so the JIT compiles every module at once. The functions differ
+# only in their names, so every module costs the same to compile. Compares one JIT
+# thread with all of them, with lazy compilation off.
+#
+# usage: bench/parallel_compile.sh [./main] [max functions]
+
+MAIN=${1:-./main}
+MAX_FUNCTIONS=${2:-4000}
+CORES=${CORES:-$(nproc)}
+
+. "$(dirname "$0")/common.sh"
+
+program() {
+    awk -v n="$1" 'BEGIN {
+        for (i = 0; i < n; ++i)
+            printf "fun f%d(x) var s = 0 in (for (i = 0; i < x; 1) s = s * 3 + i) + s;\n", i
+        printf "f0(3)"
+        for (i = 1; i < n; ++i) printf " + f%d(3)", i
+        print ";"
+    }'
+}
+
+printf "%-8s %10s %10s\n" threads functions seconds
+for (( functions = 250; functions <= MAX_FUNCTIONS; functions *= 2 )); do
+    program $functions > "$INPUT"
+    for threads in 1 $CORES; do
+        run_timed "$(printf "%-8s %10d" $threads $functions)" --no-lazy --jobs $threads
+    done
+done
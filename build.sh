@@ -12,9 +12,19 @@ LLVM_FLAGS=$(
 )
 
 SRCS=(
+    ./arena.cpp
     ./ast.cpp
+    ./codegen.cpp
     ./context.cpp
+    ./environment.cpp
+    ./jit_memory.cpp
+    ./opcode.cpp
+    ./options.cpp
+    ./source.cpp
+    ./symbol.cpp
     ./parser.cpp
+    ./scan.cpp
+    ./token_array.cpp
     ./tokenizer.cpp
     ./main.cpp
 )
@@ -0,0 +1,384 @@
+#include "ast.h"
+#include "codegen.h"
+#include "context.h"
+
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstrTypes.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+
+namespace Codegen {
+
+namespace {
+
+template <llvm::CmpInst::Predicate pred>
+llvm::Value *compare(llvm::Value *lhs, llvm::Value *rhs)
+{
+    return Context::IRManager::getBuilder()->CreateZExt(
+            Context::IRManager::getBuilder()->CreateICmp(pred, lhs, rhs, "booltmp"),
+            llvm::Type::getInt64Ty(*Context::IRManager::getCtx()));
+}
+
+using BinaryEmitter = llvm::Value *(*)(llvm::Value *lhs, llvm::Value *rhs);
+
+// '&&' and '||' branch and '=' stores, they have no entry here
+constexpr auto binaryEmitters = [] {
+    std::array<BinaryEmitter, AST::BUILTIN_OPCODE_COUNT> table{};
+    auto set = [&table](AST::Opcode op, BinaryEmitter emit) {
+        table[static_cast<size_t>(op)] = emit;
+    };
+
+    set(AST::Opcode::ADD, [](llvm::Value *lhs, llvm::Value *rhs) -> llvm::Value * {
+        return Context::IRManager::getBuilder()->CreateAdd(lhs, rhs, "addtmp");
+    });
+    set(AST::Opcode::SUB, [](llvm::Value *lhs, llvm::Value *rhs) -> llvm::Value * {
+        return Context::IRManager::getBuilder()->CreateSub(lhs, rhs, "rhssubtmp");
+    });
+    set(AST::Opcode::MUL, [](llvm::Value *lhs, llvm::Value *rhs) -> llvm::Value * {
+        return Context::IRManager::getBuilder()->CreateMul(lhs, rhs, "rhsmultmp");
+    });
+    set(AST::Opcode::DIV, [](llvm::Value *lhs, llvm::Value *rhs) -> llvm::Value * {
+        return Context::IRManager::getBuilder()->CreateSDiv(lhs, rhs, "divtmp");
+    });
+    set(AST::Opcode::MOD, [](llvm::Value *lhs, llvm::Value *rhs) -> llvm::Value * {
+        return Context::IRManager::getBuilder()->CreateSRem(lhs, rhs, "remtmp");
+    });
+    set(AST::Opcode::BIT_AND, [](llvm::Value *lhs, llvm::Value *rhs) -> llvm::Value * {
+        return Context::IRManager::getBuilder()->CreateAnd(lhs, rhs, "andtmp");
+    });
+    set(AST::Opcode::BIT_OR, [](llvm::Value *lhs, llvm::Value *rhs) -> llvm::Value * {
+        return Context::IRManager::getBuilder()->CreateOr(lhs, rhs, "ortmp");
+    });
+    set(AST::Opcode::SHL, [](llvm::Value *lhs, llvm::Value *rhs) -> llvm::Value * {
+        return Context::IRManager::getBuilder()->CreateShl(lhs, rhs, "shltmp");
+    });
+    set(AST::Opcode::SHR, [](llvm::Value *lhs, llvm::Value *rhs) -> llvm::Value * {
+        return Context::IRManager::getBuilder()->CreateAShr(lhs, rhs, "shrtmp");
+    });
+
+    set(AST::Opcode::LESS,       compare<llvm::CmpInst::ICMP_SLT>);
+    set(AST::Opcode::GREATER,    compare<llvm::CmpInst::ICMP_SGT>);
+    set(AST::Opcode::LESS_EQ,    compare<llvm::CmpInst::ICMP_SLE>);
+    set(AST::Opcode::GREATER_EQ, compare<llvm::CmpInst::ICMP_SGE>);
+    set(AST::Opcode::EQ,         compare<llvm::CmpInst::ICMP_EQ>);
+    set(AST::Opcode::NOT_EQ,     compare<llvm::CmpInst::ICMP_NE>);
+    return table;
+}();
+
+// slot of a local in the entry block, so mem2reg can promote it
+llvm::AllocaInst *createEntryAlloca(Symbol::Id name)
+{
+    llvm::Function *func = Context::IRManager::getBuilder()->GetInsertBlock()->getParent();
+    llvm::IRBuilder<> entry(&func->getEntryBlock(), func->getEntryBlock().begin());
+    return entry.CreateAlloca(
+            llvm::Type::getInt64Ty(*Context::IRManager::getCtx()),
+            nullptr,
+            Symbol::name(name));
+}
+
+// call of the 'binary<op>' function
+llvm::Value *userOperator(AST::Opcode op, llvm::Value *lhs, llvm::Value *rhs)
+{
+    const auto &info = AST::getOperator(op);
+    llvm::Function *func = AST::findFunction(info.function);
+    if (!func) {
+        std::string msg = "Unknown binary operator ";
+        msg += info.spelling;
+        return AST::LogErrorV(msg.c_str());
+    }
+    return Context::IRManager::getBuilder()->CreateCall(func, { lhs, rhs }, "binop");
+}
+
+} // namespace
+
+llvm::Value *constant(int64_t value)
+{
+    return llvm::ConstantInt::get(
+            *Context::IRManager::getCtx(),
+            llvm::APInt(64, value));
+}
+
+llvm::Value *variable(Symbol::Id name)
+{
+    llvm::Value *slot = Context::IRManager::getEnv().lookup(name);
+    if (!slot) {
+        std::string msg = "Unknown variable name ";
+        msg += Symbol::name(name);
+        return AST::LogErrorV(msg.c_str());
+    }
+    return Context::IRManager::getBuilder()->CreateLoad(
+            llvm::Type::getInt64Ty(*Context::IRManager::getCtx()),
+            slot,
+            Symbol::name(name));
+}
+
+llvm::Value *assign(Symbol::Id name, llvm::Value *value)
+{
+    llvm::Value *slot = Context::IRManager::getEnv().lookup(name);
+    if (!slot) {
+        std::string msg = "Unknown variable name ";
+        msg += Symbol::name(name);
+        return AST::LogErrorV(msg.c_str());
+    }
+    Context::IRManager::getBuilder()->CreateStore(value, slot);
+    return value;
+}
+
+void declare(Symbol::Id name, llvm::Value *init)
+{
+    llvm::AllocaInst *slot = createEntryAlloca(name);
+    Context::IRManager::getBuilder()->CreateStore(init, slot);
+    Context::IRManager::getEnv().bind(name, slot);
+}
+
+llvm::Value *binary(AST::Opcode op, llvm::Value *lhs, llvm::Value *rhs)
+{
+    if (AST::isUserOperator(op)) {
+        return userOperator(op, lhs, rhs);
+    }
+    if (op < AST::Opcode::BUILTIN_COUNT) {
+        if (auto emit = binaryEmitters[static_cast<size_t>(op)]) {
+            return emit(lhs, rhs);
+        }
+    }
+
+    std::string msg = "invalid binary operator ";
+    msg += AST::getSpelling(op);
+    msg += (" for " + lhs->getName() + " | " + rhs->getName()).str();
+    return AST::LogErrorV(msg.c_str());
+}
+
+llvm::Value *logical(bool isAnd, llvm::Value *lhs, Emit rhsExpr, bool rhsSpeculatable)
+{
+    auto *builder = Context::IRManager::getBuilder();
+    auto *zero = llvm::ConstantInt::get(*Context::IRManager::getCtx(), llvm::APInt(64, 0));
+
+    llvm::Value *lhsCond = builder->CreateICmpNE(lhs, zero, "lhscond");
+
+    // rhs is safe to evaluate anyway, pick the result without branches
+    if (rhsSpeculatable) {
+        llvm::Value *rhs = rhsExpr();
+        if (!rhs) {
+            return nullptr;
+        }
+        llvm::Value *rhsCond = builder->CreateICmpNE(rhs, zero, "rhscond");
+        llvm::Value *result = isAnd
+            ? builder->CreateLogicalAnd(lhsCond, rhsCond, "andcond")
+            : builder->CreateLogicalOr(lhsCond, rhsCond, "orcond");
+        return builder->CreateZExt(result, llvm::Type::getInt64Ty(*Context::IRManager::getCtx()));
+    }
+
+    // short circuit
+    llvm::Function *func = builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock *lhsBB = builder->GetInsertBlock();
+    llvm::BasicBlock *rhsBB =
+        llvm::BasicBlock::Create(*Context::IRManager::getCtx(), "logicrhs", func);
+    llvm::BasicBlock *mergeBB =
+        llvm::BasicBlock::Create(*Context::IRManager::getCtx(), "logiccont");
+
+    if (isAnd) {
+        builder->CreateCondBr(lhsCond, rhsBB, mergeBB);
+    }
+    else {
+        builder->CreateCondBr(lhsCond, mergeBB, rhsBB);
+    }
+
+    builder->SetInsertPoint(rhsBB);
+    llvm::Value *rhs = rhsExpr();
+    if (!rhs) {
+        return nullptr;
+    }
+    llvm::Value *rhsCond = builder->CreateICmpNE(rhs, zero, "rhscond");
+    builder->CreateBr(mergeBB);
+    rhsBB = builder->GetInsertBlock();
+
+    func->insert(func->end(), mergeBB);
+    builder->SetInsertPoint(mergeBB);
+    llvm::PHINode *phiNode = builder->CreatePHI(
+        llvm::Type::getInt1Ty(*Context::IRManager::getCtx()),
+        2,
+        "logictmp");
+    phiNode->addIncoming(builder->getInt1(!isAnd), lhsBB);
+    phiNode->addIncoming(rhsCond, rhsBB);
+    return builder->CreateZExt(phiNode, llvm::Type::getInt64Ty(*Context::IRManager::getCtx()));
+}
+
+llvm::Value *call(Symbol::Id callee, size_t argCount, EmitArg arg)
+{
+    llvm::Function *calleeF = AST::findFunction(callee);
+    if (!calleeF) {
+        std::string msg = "Unknown function reference ";
+        msg += Symbol::name(callee);
+        return AST::LogErrorV(msg.c_str());
+    }
+    if (calleeF->arg_size() != argCount) {
+        std::string msg = "Incorrect incorrect number of arguments passed for ";
+        msg += Symbol::name(callee);
+        return AST::LogErrorV(msg.c_str());
+    }
+
+    std::vector<llvm::Value *> argsValues;
+    for (size_t i = 0; i != argCount; ++i) {
+        argsValues.push_back(arg(i));
+        if (!argsValues.back())
+            return nullptr;
+    }
+
+    return Context::IRManager::getBuilder()->CreateCall(
+            calleeF,
+            argsValues,
+            "calltmp");
+}
+
+llvm::Value *ifElse(llvm::Value *condValue, Emit thenExpr, Emit elseExpr)
+{
+    auto rhs = llvm::ConstantInt::get(
+            *Context::IRManager::getCtx(),
+            llvm::APInt(64, 0));
+
+    condValue = Context::IRManager::getBuilder()->CreateICmpNE(
+        condValue,
+        rhs,
+        "ifcond");
+
+    llvm::Function *func = Context::IRManager::getBuilder()->GetInsertBlock()->getParent();
+
+    llvm::BasicBlock *thenBB =
+        llvm::BasicBlock::Create(*Context::IRManager::getCtx(), "then", func);
+    llvm::BasicBlock *elseBB =
+        llvm::BasicBlock::Create(*Context::IRManager::getCtx(), "else");
+    llvm::BasicBlock *mergeBB =
+        llvm::BasicBlock::Create(*Context::IRManager::getCtx(), "ifcont");
+
+    Context::IRManager::getBuilder()->CreateCondBr(condValue, thenBB, elseBB);
+
+    Context::IRManager::getBuilder()->SetInsertPoint(thenBB);
+
+    llvm::Value *thenValue = thenExpr();
+    if (!thenValue) {
+        return nullptr;
+    }
+
+    Context::IRManager::getBuilder()->CreateBr(mergeBB);
+    thenBB = Context::IRManager::getBuilder()->GetInsertBlock();
+
+    func->insert(func->end(), elseBB);
+    Context::IRManager::getBuilder()->SetInsertPoint(elseBB);
+
+    llvm::Value *elseValue = elseExpr();
+    if (!elseValue) {
+        return nullptr;
+    }
+
+    Context::IRManager::getBuilder()->CreateBr(mergeBB);
+    elseBB = Context::IRManager::getBuilder()->GetInsertBlock();
+
+    func->insert(func->end(), mergeBB);
+    Context::IRManager::getBuilder()->SetInsertPoint(mergeBB);
+    llvm::PHINode *phiNode =
+        Context::IRManager::getBuilder()->CreatePHI(
+            llvm::Type::getInt64Ty(*Context::IRManager::getCtx()),
+            2,
+            "iftmp");
+
+    phiNode->addIncoming(thenValue, thenBB);
+    phiNode->addIncoming(elseValue, elseBB);
+    return phiNode;
+}
+
+llvm::Value *varIn(std::span<const Symbol::Id> names, EmitArg init, Emit body)
+{
+    Context::Scope scope(Context::IRManager::getEnv());
+    for (size_t i = 0; i != names.size(); ++i) {
+        llvm::Value *initVal = init(i);
+        if (!initVal) {
+            return nullptr;
+        }
+        declare(names[i], initVal);
+    }
+    return body();
+}
+
+llvm::Value *forLoop(
+        Symbol::Id iterName,
+        llvm::Value *startVal,
+        Emit end,
+        Emit step,
+        Emit body)
+{
+    auto *builder = Context::IRManager::getBuilder();
+    llvm::Function *func = builder->GetInsertBlock()->getParent();
+
+    Context::Scope scope(Context::IRManager::getEnv());
+    declare(iterName, startVal);
+    llvm::Value *slot = Context::IRManager::getEnv().lookup(iterName);
+
+    // Rotated loop: the condition is emitted twice, as the guard before
+    // the preheader and as the exit test in the latch, so the loop passes
+    // find a canonical loop with a dedicated exit.
+    auto cond = [&end, builder]() -> llvm::Value * {
+        llvm::Value *endVal = end();
+        if (!endVal) {
+            return nullptr;
+        }
+        return builder->CreateICmpNE(endVal, constant(0), "loopcond");
+    };
+
+    llvm::BasicBlock *preheaderBB =
+        llvm::BasicBlock::Create(*Context::IRManager::getCtx(), "preheader", func);
+    llvm::BasicBlock *loopBB =
+        llvm::BasicBlock::Create(*Context::IRManager::getCtx(), "loop");
+    llvm::BasicBlock *exitBB =
+        llvm::BasicBlock::Create(*Context::IRManager::getCtx(), "loopexit");
+    llvm::BasicBlock *afterBB =
+        llvm::BasicBlock::Create(*Context::IRManager::getCtx(), "afterloop");
+
+    llvm::Value *guard = cond();
+    if (!guard) {
+        return nullptr;
+    }
+    builder->CreateCondBr(guard, preheaderBB, afterBB);
+
+    builder->SetInsertPoint(preheaderBB);
+    builder->CreateBr(loopBB);
+
+    func->insert(func->end(), loopBB);
+    builder->SetInsertPoint(loopBB);
+
+    if (!body()) {
+        return nullptr;
+    }
+
+    llvm::Value *stepVal = step ? step() : constant(1);
+    if (!stepVal) {
+        return nullptr;
+    }
+
+    // the body may have assigned the iterator
+    llvm::Value *iter = builder->CreateLoad(
+            llvm::Type::getInt64Ty(*Context::IRManager::getCtx()),
+            slot,
+            Symbol::name(iterName));
+    builder->CreateStore(builder->CreateAdd(iter, stepVal, "nextvar"), slot);
+
+    llvm::Value *latch = cond();
+    if (!latch) {
+        return nullptr;
+    }
+    builder->CreateCondBr(latch, loopBB, exitBB);
+
+    func->insert(func->end(), exitBB);
+    builder->SetInsertPoint(exitBB);
+    builder->CreateBr(afterBB);
+
+    func->insert(func->end(), afterBB);
+    builder->SetInsertPoint(afterBB);
+
+    // for always evaluates to 0
+    return constant(0);
+}
+
+} // namespace Codegen
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "opcode.h"
+#include "symbol.h"
+
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/IR/Value.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+
+// IR emission of the AST nodes.
+// Operands that are always evaluated come in already emitted,
+// the ones that go to their own blocks are emitted by callbacks.
+namespace Codegen {
+
+using Emit = llvm::function_ref<llvm::Value *()>;
+using EmitArg = llvm::function_ref<llvm::Value *(size_t)>;
+
+llvm::Value *constant(int64_t value);
+
+// loads a local, arguments included
+llvm::Value *variable(Symbol::Id name);
+
+// stores to a local, evaluates to `value`
+llvm::Value *assign(Symbol::Id name, llvm::Value *value);
+
+// binds `name` in the innermost scope to a new entry block slot holding `init`
+void declare(Symbol::Id name, llvm::Value *init);
+
+// everything but '&&' and '||'
+llvm::Value *binary(AST::Opcode op, llvm::Value *lhs, llvm::Value *rhs);
+
+// '&&' and '||', rhs is evaluated without branches when it is speculatable
+llvm::Value *logical(bool isAnd, llvm::Value *lhs, Emit rhs, bool rhsSpeculatable);
+
+llvm::Value *call(Symbol::Id callee, size_t argCount, EmitArg arg);
+
+llvm::Value *ifElse(llvm::Value *cond, Emit thenExpr, Emit elseExpr);
+
+// 'var' bindings around `body`, every init sees the earlier names
+llvm::Value *varIn(std::span<const Symbol::Id> names, EmitArg init, Emit body);
+
+// `end` is checked before every pass, the first one included;
+// step may be empty
+llvm::Value *forLoop(
+        Symbol::Id iterName,
+        llvm::Value *start,
+        Emit end,
+        Emit step,
+        Emit body);
+
+} // namespace Codegen
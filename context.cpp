@@ -1,6 +1,14 @@
 #include "ast.h"
 #include "context.h"
 
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Format.h"
+
+#include <chrono>
+#include <memory>
+
 
 namespace Context {
 
@@ -10,9 +18,90 @@ IRManager *_this = nullptr;
 // jit
 std::unique_ptr<llvm::orc::ShitJIT> __jit;
 
+// pass builder of the session and its analyses
+struct PassSetup {
+    PassSetup(llvm::TargetMachine &tm, llvm::OptimizationLevel level)
+        : pb(&tm),
+          level(level)
+    { }
+
+    // the analyses registered by it refer to it
+    llvm::PassBuilder pb;
+    llvm::OptimizationLevel level;
+
+    llvm::LoopAnalysisManager lam;
+    llvm::FunctionAnalysisManager fam;
+    llvm::CGSCCAnalysisManager cgam;
+    llvm::ModuleAnalysisManager mam;
+};
+std::unique_ptr<PassSetup> __passes;
+
 // Values
-std::map<std::string, llvm::Value*> __values;
-std::map<std::string, std::unique_ptr<AST::PrototypeAST>> __functionProtos;
+Environment __env;
+llvm::DenseMap<Symbol::Id, std::unique_ptr<AST::PrototypeAST>> __functionProtos;
+llvm::OptimizationLevel toPassLevel(Options::OptLevel level)
+{
+    switch (level) {
+        case Options::OptLevel::O0: return llvm::OptimizationLevel::O0;
+        case Options::OptLevel::O1: return llvm::OptimizationLevel::O1;
+        case Options::OptLevel::O2: return llvm::OptimizationLevel::O2;
+        case Options::OptLevel::O3: return llvm::OptimizationLevel::O3;
+        case Options::OptLevel::Os: return llvm::OptimizationLevel::Os;
+    }
+    return llvm::OptimizationLevel::O2;
+}
+
+llvm::CodeGenOpt::Level toCodeGenLevel(Options::OptLevel level)
+{
+    switch (level) {
+        case Options::OptLevel::O0: return llvm::CodeGenOpt::None;
+        case Options::OptLevel::O1: return llvm::CodeGenOpt::Less;
+        case Options::OptLevel::O2: return llvm::CodeGenOpt::Default;
+        case Options::OptLevel::O3: return llvm::CodeGenOpt::Aggressive;
+        case Options::OptLevel::Os: return llvm::CodeGenOpt::Default;
+    }
+    return llvm::CodeGenOpt::Default;
+}
+
+llvm::orc::HugePageMode toHugePageMode(Options::HugePages pages)
+{
+    switch (pages) {
+        case Options::HugePages::None: return llvm::orc::HugePageMode::None;
+        case Options::HugePages::Transparent: return llvm::orc::HugePageMode::Transparent;
+        case Options::HugePages::Explicit: return llvm::orc::HugePageMode::Explicit;
+    }
+    return llvm::orc::HugePageMode::None;
+}
+
+std::unique_ptr<PassSetup> setupPasses(llvm::TargetMachine &tm)
+{
+    auto passes = std::make_unique<PassSetup>(tm, toPassLevel(Options::get().optLevel));
+
+    auto &pb = passes->pb;
+    pb.registerModuleAnalyses(passes->mam);
+    pb.registerCGSCCAnalyses(passes->cgam);
+    pb.registerFunctionAnalyses(passes->fam);
+    pb.registerLoopAnalyses(passes->lam);
+    pb.crossRegisterProxies(passes->lam, passes->fam, passes->cgam, passes->mam);
+    return passes;
+}
+
+// triple, CPU and enabled features
+void printTarget(const llvm::TargetMachine &tm)
+{
+    llvm::SmallVector<llvm::StringRef, 64> features;
+    for (auto feature : llvm::split(tm.getTargetFeatureString(), ',')) {
+        if (feature.consume_front("+")) {
+            features.push_back(feature);
+        }
+    }
+    llvm::sort(features);
+
+    llvm::errs() << "JIT target: " << tm.getTargetTriple().str()
+                 << ", cpu: " << tm.getTargetCPU()
+                 << ", features: " << llvm::join(features, ",") << "\n";
+}
+
 } // namespace
 
 IRManager* IRManager::get()
@@ -56,32 +145,66 @@ std::unique_ptr<IRManager::Module> IRManager::moveModule()
 llvm::orc::ShitJIT *IRManager::getJIT()
 {
     if (__jit == nullptr) {
-        auto jit = llvm::orc::ShitJIT::Create();
+        auto jit = llvm::orc::ShitJIT::Create(
+                toCodeGenLevel(Options::get().optLevel),
+                Options::get().cpu,
+                Options::get().features,
+                Options::get().lazy,
+                Options::get().jobs,
+                Options::get().jitLink,
+                toHugePageMode(Options::get().hugePages));
         if (auto err = jit.takeError()) {
             llvm::errs() << "Cannot create a JIT " << toString(std::move(err)) << "\n";
             return nullptr;
         }
         __jit = std::unique_ptr<llvm::orc::ShitJIT>(jit->release());
+
+        if (Options::get().printTarget) {
+            printTarget(__jit->getTargetMachine());
+        }
     }
     return __jit.get();
 }
 
-llvm::FunctionPassManager* IRManager::getFPM()
+void IRManager::printLinkStats()
 {
-    return get()->fpm_.get();
+    size_t objects = __jit ? __jit->getLinkedObjects() : 0;
+    double ms = __jit ? std::chrono::duration<double, std::milli>(__jit->getLinkTime()).count() : 0;
+    llvm::errs() << llvm::format("JIT linked %zu objects in %.3f ms, %.1f us per object\n",
+                                 objects, ms, objects ? ms * 1000 / objects : 0.0);
 }
 
-llvm::FunctionAnalysisManager* IRManager::getFAM()
+void IRManager::optimize()
 {
-    return get()->fam_.get();
+    if (!__passes) {
+        __passes = setupPasses(getJIT()->getTargetMachine());
+    }
+
+    // Only the pass list is made per module. Passes keep state from the
+    // modules they ran on, and one list run over every module got slower
+    // with each of them.
+    auto &pb = __passes->pb;
+    auto level = __passes->level;
+    // O0 has a pipeline of its own, the default one asserts on it
+    auto mpm = level == llvm::OptimizationLevel::O0
+        ? pb.buildO0DefaultPipeline(level)
+        : pb.buildPerModuleDefaultPipeline(level);
+    mpm.run(*getModule(), __passes->mam);
+
+    // results are keyed by the IR they describe, and the module is freed
+    // once it is linked, so nothing is kept for the next one
+    __passes->lam.clear();
+    __passes->fam.clear();
+    __passes->cgam.clear();
+    __passes->mam.clear();
 }
 
-std::map<std::string, llvm::Value*>& IRManager::getValues()
+Environment& IRManager::getEnv()
 {
-    return __values;
+    return __env;
 }
 
-std::map<std::string, std::unique_ptr<AST::PrototypeAST>>& IRManager::getFunctionProtos()
+llvm::DenseMap<Symbol::Id, std::unique_ptr<AST::PrototypeAST>>& IRManager::getFunctionProtos()
 {
     return __functionProtos;
 }
@@ -89,29 +212,10 @@ std::map<std::string, std::unique_ptr<AST::PrototypeAST>>& IRManager::getFunctio
 IRManager::IRManager()
     : context_(std::make_unique<Context>()),
       builder_(std::make_unique<Builder>(*context_)),
-      module_(std::make_unique<Module>("someShitJIT", *context_)),
-      fpm_(std::make_unique<llvm::FunctionPassManager>()),
-      lam_(std::make_unique<llvm::LoopAnalysisManager>()),
-      fam_(std::make_unique<llvm::FunctionAnalysisManager>()),
-      cgam_(std::make_unique<llvm::CGSCCAnalysisManager>()),
-      mam_(std::make_unique<llvm::ModuleAnalysisManager>()),
-      pic_(std::make_unique<llvm::PassInstrumentationCallbacks>()),
-      si_(std::make_unique<llvm::StandardInstrumentations>(
-          *context_,
-          /*DebugLogging*/ true))
+      module_(std::make_unique<Module>("someShitJIT", *context_))
 {
    module_->setDataLayout(IRManager::getJIT()->getDataLayout());
-
-   si_->registerCallbacks(*pic_, mam_.get());
-   fpm_->addPass(llvm::InstCombinePass());
-   fpm_->addPass(llvm::ReassociatePass());
-   fpm_->addPass(llvm::GVNPass());
-   fpm_->addPass(llvm::SimplifyCFGPass());
-
-   llvm::PassBuilder PB;
-   PB.registerModuleAnalyses(*mam_);
-   PB.registerFunctionAnalyses(*fam_);
-   PB.crossRegisterProxies(*lam_, *fam_, *cgam_, *mam_);
+   module_->setTargetTriple(IRManager::getJIT()->getTargetMachine().getTargetTriple().str());
 }
 
 } // namespace Context
@@ -1,14 +1,12 @@
 #pragma once
 
+#include "environment.h"
 #include "jit.h"
+#include "options.h"
+#include "symbol.h"
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Passes/PassBuilder.h"
-#include "llvm/Passes/StandardInstrumentations.h"
-#include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar.h"
-#include "llvm/Transforms/Scalar/GVN.h"
-#include "llvm/Transforms/Scalar/Reassociate.h"
-#include "llvm/Transforms/Scalar/SimplifyCFG.h"
 
 namespace AST {
 class PrototypeAST;
@@ -33,11 +31,17 @@ public:
     static std::unique_ptr<Module> moveModule();
 
     static llvm::orc::ShitJIT *getJIT();
-    static llvm::FunctionPassManager *getFPM();
-    static llvm::FunctionAnalysisManager *getFAM();
 
-    static std::map<std::string, llvm::Value *> &getValues();
-    static std::map<std::string, std::unique_ptr<AST::PrototypeAST>> &getFunctionProtos();
+    // objects the JIT linked and the time it spent per object
+    static void printLinkStats();
+
+    // Runs the pipeline of the -O level on the current module. The pass
+    // builder and the analysis managers are set up once, by the first call.
+    static void optimize();
+
+    // locals of the function being generated
+    static Environment &getEnv();
+    static llvm::DenseMap<Symbol::Id, std::unique_ptr<AST::PrototypeAST>> &getFunctionProtos();
 
     template <class T>
     static auto onErr(T arg)
@@ -53,15 +57,6 @@ private:
     std::unique_ptr<Builder> builder_;
     std::unique_ptr<Module> module_;
 
-    // JIT
-    std::unique_ptr<llvm::FunctionPassManager> fpm_;
-    std::unique_ptr<llvm::LoopAnalysisManager> lam_;
-    std::unique_ptr<llvm::FunctionAnalysisManager> fam_;
-    std::unique_ptr<llvm::CGSCCAnalysisManager> cgam_;
-    std::unique_ptr<llvm::ModuleAnalysisManager> mam_;
-    std::unique_ptr<llvm::PassInstrumentationCallbacks> pic_;
-    std::unique_ptr<llvm::StandardInstrumentations> si_;
-
     // Error
     llvm::ExitOnError __exitOnErr;
 };
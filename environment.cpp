@@ -0,0 +1,42 @@
+#include "environment.h"
+
+
+namespace Context {
+
+void Environment::bind(Symbol::Id name, llvm::Value *value)
+{
+    if (name >= bindings_.size()) {
+        bindings_.resize(name + 1);
+    }
+    shadowed_.emplace_back(name, bindings_[name]);
+    bindings_[name] = value;
+}
+
+void Environment::push()
+{
+    marks_.push_back(shadowed_.size());
+}
+
+void Environment::pop()
+{
+    size_t mark = marks_.back();
+    marks_.pop_back();
+    while (shadowed_.size() != mark) {
+        auto [name, value] = shadowed_.back();
+        bindings_[name] = value;
+        shadowed_.pop_back();
+    }
+}
+
+Scope::Scope(Environment &env)
+    : env_(env)
+{
+    env_.push();
+}
+
+Scope::~Scope()
+{
+    env_.pop();
+}
+
+} // namespace Context
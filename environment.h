@@ -0,0 +1,57 @@
+#pragma once
+
+#include "symbol.h"
+
+#include "llvm/IR/Value.h"
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+
+namespace Context {
+
+// Lexical scopes of the function being generated.
+// Every name has one slot in an array indexed by its id that holds the
+// innermost binding, so lookups never hash. Bindings shadowed by a scope
+// go to an undo log and are brought back when the scope is popped.
+class Environment {
+public:
+    // innermost binding of `name`, nullptr if there is none
+    llvm::Value *lookup(Symbol::Id name) const
+    {
+        return name < bindings_.size() ? bindings_[name] : nullptr;
+    }
+
+    // binds `name` in the innermost scope
+    void bind(Symbol::Id name, llvm::Value *value);
+
+    void push();
+
+    // drops the bindings of the innermost scope
+    void pop();
+
+private:
+    std::vector<llvm::Value *> bindings_;
+
+    // bindings to bring back, with their names
+    std::vector<std::pair<Symbol::Id, llvm::Value *>> shadowed_;
+
+    // size of shadowed_ when each open scope was pushed
+    std::vector<size_t> marks_;
+};
+
+// scope open for the lifetime of the object
+class Scope {
+public:
+    explicit Scope(Environment &env);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    Environment &env_;
+};
+
+} // namespace Context
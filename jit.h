@@ -1,78 +1,277 @@
 #pragma once
 
+#include "jit_memory.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/EPCEHFrameRegistrar.h"
+#include "llvm/ExecutionEngine/Orc/EPCIndirectionUtils.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
 #include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/Shared/ExecutorSymbolDef.h"
-#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/ExecutionEngine/Orc/TaskDispatch.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/TargetParser/SubtargetFeature.h"
+#include <chrono>
 #include <memory>
+#include <mutex>
 
 namespace llvm::orc {
 
+// Time from an object reaching the object layer to its emission: parsing,
+// allocation, symbol resolution and relocation. Waiting for symbols that
+// are materialized meanwhile counts too.
+class LinkTimer {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::mutex Mutex;
+    DenseMap<MaterializationResponsibility *, Clock::time_point> Started;
+    size_t Objects = 0;
+    Clock::duration Total{};
+
+public:
+    void start(MaterializationResponsibility &MR)
+    {
+        auto Now = Clock::now();
+        std::lock_guard Lock(Mutex);
+        Started[&MR] = Now;
+    }
+
+    void stop(MaterializationResponsibility &MR)
+    {
+        auto Now = Clock::now();
+        std::lock_guard Lock(Mutex);
+        auto It = Started.find(&MR);
+        if (It == Started.end())
+            return;
+        Total += Now - It->second;
+        ++Objects;
+        Started.erase(It);
+    }
+
+    void drop(MaterializationResponsibility &MR)
+    {
+        std::lock_guard Lock(Mutex);
+        Started.erase(&MR);
+    }
+
+    size_t getObjects()
+    {
+        std::lock_guard Lock(Mutex);
+        return Objects;
+    }
+
+    std::chrono::nanoseconds getTotal()
+    {
+        std::lock_guard Lock(Mutex);
+        return Total;
+    }
+};
+
+// stops the timer of objects JITLink emits
+class LinkTimerPlugin : public ObjectLinkingLayer::Plugin {
+private:
+    LinkTimer &Timer;
+
+public:
+    explicit LinkTimerPlugin(LinkTimer &Timer) : Timer(Timer) {}
+
+    Error notifyEmitted(MaterializationResponsibility &MR) override
+    {
+        Timer.stop(MR);
+        return Error::success();
+    }
+
+    Error notifyFailed(MaterializationResponsibility &MR) override
+    {
+        Timer.drop(MR);
+        return Error::success();
+    }
+
+    Error notifyRemovingResources(JITDylib &, ResourceKey) override { return Error::success(); }
+
+    void notifyTransferringResources(JITDylib &, ResourceKey, ResourceKey) override {}
+};
+
 class ShitJIT {
 private:
     std::unique_ptr<ExecutionSession> ES;
+    std::unique_ptr<EPCIndirectionUtils> EPCIU;
 
     DataLayout DL;
     MangleAndInterner Mangle;
 
-    RTDyldObjectLinkingLayer ObjectLayer;
+    // code and data of the objects RuntimeDyld links, null with JITLink
+    std::unique_ptr<SlabPool> Pool;
+
+    LinkTimer Timer;
+
+    // RuntimeDyld or JITLink
+    std::unique_ptr<ObjectLayer> ObjLayer;
     IRCompileLayer CompileLayer;
 
+    // Functions of modules added through it are compiled on their first
+    // call, callers go through indirect stubs until then.
+    CompileOnDemandLayer CODLayer;
+    bool Lazy;
+
     JITDylib &MainJD;
 
+    // for the target-aware IR passes, the compile layer makes its own
+    std::unique_ptr<TargetMachine> TM;
+
+    static void handleLazyCallThroughError()
+    {
+        errs() << "LazyCallThrough error: Could not find function body";
+        exit(1);
+    }
+
+    static std::unique_ptr<ObjectLayer> createObjectLayer(
+            ExecutionSession &ES, const Triple &TT, SlabPool *Pool, LinkTimer &Timer)
+    {
+        if (!Pool) {
+            // allocates through the process' memory manager, plugins see every link
+            auto Layer = std::make_unique<ObjectLinkingLayer>(ES);
+            if (auto Registrar = EPCEHFrameRegistrar::Create(ES))
+                Layer->addPlugin(std::make_unique<EHFrameRegistrationPlugin>(ES, std::move(*Registrar)));
+            else
+                ES.reportError(Registrar.takeError());
+            Layer->addPlugin(std::make_unique<LinkTimerPlugin>(Timer));
+            return Layer;
+        }
+
+        auto Layer = std::make_unique<RTDyldObjectLinkingLayer>(ES, [Pool]()
+                { return std::make_unique<SlabMemoryManager>(*Pool); });
+        Layer->setNotifyEmitted([&Timer](MaterializationResponsibility &MR, std::unique_ptr<MemoryBuffer>)
+                { Timer.stop(MR); });
+        if (TT.isOSBinFormatCOFF()) {
+            Layer->setOverrideObjectFlagsWithResponsibilityFlags(true);
+            Layer->setAutoClaimResponsibilityForObjectSymbols(true);
+        }
+        return Layer;
+    }
+
 public:
-    ShitJIT(std::unique_ptr<ExecutionSession> ES, JITTargetMachineBuilder JTMB, DataLayout DL)
-        : ES(std::move(ES)), DL(std::move(DL)), Mangle(*this->ES, this->DL),
-          ObjectLayer(*this->ES, []()
-                      { return std::make_unique<SectionMemoryManager>(); }),
-          CompileLayer(*this->ES, ObjectLayer, std::make_unique<ConcurrentIRCompiler>(std::move(JTMB))),
-          MainJD(this->ES->createBareJITDylib("<main>"))
+    ShitJIT(std::unique_ptr<ExecutionSession> ES, std::unique_ptr<EPCIndirectionUtils> EPCIU,
+            JITTargetMachineBuilder JTMB, DataLayout DL, std::unique_ptr<TargetMachine> TM, bool Lazy,
+            bool UseJITLink, HugePageMode HugePages)
+        : ES(std::move(ES)), EPCIU(std::move(EPCIU)), DL(std::move(DL)), Mangle(*this->ES, this->DL),
+          Pool(UseJITLink ? nullptr : std::make_unique<SlabPool>(HugePages)),
+          ObjLayer(createObjectLayer(*this->ES, JTMB.getTargetTriple(), Pool.get(), Timer)),
+          CompileLayer(*this->ES, *ObjLayer, std::make_unique<ConcurrentIRCompiler>(std::move(JTMB))),
+          CODLayer(*this->ES, CompileLayer, this->EPCIU->getLazyCallThroughManager(),
+                   [this] { return this->EPCIU->createIndirectStubsManager(); }),
+          Lazy(Lazy),
+          MainJD(this->ES->createBareJITDylib("<main>")),
+          TM(std::move(TM))
     {
         MainJD.addGenerator(
                 cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(DL.getGlobalPrefix())));
-        if (JTMB.getTargetTriple().isOSBinFormatCOFF()) {
-            ObjectLayer.setOverrideObjectFlagsWithResponsibilityFlags(true);
-            ObjectLayer.setAutoClaimResponsibilityForObjectSymbols(true);
-        }
+        // objects go to the object layer right after this
+        CompileLayer.setNotifyCompiled([this](MaterializationResponsibility &MR, ThreadSafeModule)
+                { Timer.start(MR); });
     }
 
     ~ShitJIT()
     {
         if (auto Err = ES->endSession())
             ES->reportError(std::move(Err));
+        if (auto Err = EPCIU->cleanup())
+            ES->reportError(std::move(Err));
     }
 
-    static Expected<std::unique_ptr<ShitJIT>> Create()
+    // Generates code for the host CPU and its features unless CPU is set to
+    // another one. Features are comma separated "+name" or "-name" on top.
+    // Lazy JITs compile every function on its first call.
+    // With more than one of Threads, every materialization task gets a thread
+    // of its own: tasks block in lookups of symbols other tasks materialize,
+    // and a fixed number of threads could all end up waiting. Compilation
+    // runs on the calling thread otherwise.
+    // Objects are linked by JITLink if UseJITLink is set, RuntimeDyld otherwise.
+    // RuntimeDyld packs them into slabs backed by pages of the HugePages kind.
+    static Expected<std::unique_ptr<ShitJIT>> Create(
+            CodeGenOpt::Level OptLevel = CodeGenOpt::Default,
+            StringRef CPU = "",
+            StringRef Features = "",
+            bool Lazy = true,
+            unsigned Threads = 1,
+            bool UseJITLink = false,
+            HugePageMode HugePages = HugePageMode::None)
     {
-        auto EPC = SelfExecutorProcessControl::Create();
+        std::unique_ptr<TaskDispatcher> Dispatcher;
+        if (Threads > 1)
+            Dispatcher = std::make_unique<DynamicThreadPoolTaskDispatcher>();
+        else
+            Dispatcher = std::make_unique<InPlaceTaskDispatcher>();
+
+        auto EPC = SelfExecutorProcessControl::Create(nullptr, std::move(Dispatcher));
         if (!EPC)
             return EPC.takeError();
 
         auto ES = std::make_unique<ExecutionSession>(std::move(*EPC));
 
-        JITTargetMachineBuilder JTMB(
-                ES->getExecutorProcessControl().getTargetTriple());
+        auto EPCIU = EPCIndirectionUtils::Create(ES->getExecutorProcessControl());
+        if (!EPCIU)
+            return EPCIU.takeError();
+        (*EPCIU)->createLazyCallThroughManager(
+                *ES, ExecutorAddr::fromPtr(&handleLazyCallThroughError));
+        if (auto Err = setUpInProcessLCTMReentryViaEPCIU(**EPCIU))
+            return std::move(Err);
+
+        auto HostJTMB = JITTargetMachineBuilder::detectHost();
+        if (!HostJTMB)
+            return HostJTMB.takeError();
+
+        JITTargetMachineBuilder JTMB = std::move(*HostJTMB);
+        JTMB.setCodeGenOptLevel(OptLevel);
+        if (!CPU.empty() && CPU != "native") {
+            JTMB.setCPU(CPU.str());
+            JTMB.getFeatures() = SubtargetFeatures();
+        }
+
+        SmallVector<StringRef, 8> ExtraFeatures;
+        Features.split(ExtraFeatures, ',', -1, false);
+        for (StringRef Feature : ExtraFeatures)
+            JTMB.getFeatures().AddFeature(Feature.trim());
 
         auto DL = JTMB.getDefaultDataLayoutForTarget();
         if (!DL)
             return DL.takeError();
 
-        return std::make_unique<ShitJIT>(std::move(ES), std::move(JTMB), std::move(*DL));
+        auto TM = JTMB.createTargetMachine();
+        if (!TM)
+            return TM.takeError();
+
+        return std::make_unique<ShitJIT>(
+                std::move(ES), std::move(*EPCIU), std::move(JTMB), std::move(*DL), std::move(*TM), Lazy,
+                UseJITLink, HugePages);
     }
 
     const DataLayout &getDataLayout() const { return DL; }
 
+    TargetMachine &getTargetMachine() { return *TM; }
+
     JITDylib &getMainJITDylib() { return MainJD; }
 
+    // objects linked so far and the time it took, see LinkTimer
+    size_t getLinkedObjects() { return Timer.getObjects(); }
+    std::chrono::nanoseconds getLinkTime() { return Timer.getTotal(); }
+
+    // compiled as a whole when a lookup reaches it, for code that runs right away
     Error addModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr)
     {
         if (!RT)
@@ -80,6 +279,16 @@ public:
         return CompileLayer.add(RT, std::move(TSM));
     }
 
+    // compiled function by function on first call if the JIT is lazy
+    Error addLazyModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr)
+    {
+        if (!Lazy)
+            return addModule(std::move(TSM), std::move(RT));
+        if (!RT)
+            RT = MainJD.getDefaultResourceTracker();
+        return CODLayer.add(RT, std::move(TSM));
+    }
+
     Expected<ExecutorSymbolDef> lookup(StringRef Name)
     {
         return ES->lookup({ &MainJD }, Mangle(Name.str()));
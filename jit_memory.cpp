@@ -0,0 +1,283 @@
+#include "jit_memory.h"
+
+#include "llvm/Support/Memory.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+
+#include <linux/memfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+namespace llvm::orc {
+
+namespace {
+
+// sizes are kept in multiples of it so freed ranges merge cleanly
+constexpr size_t Granule = 16;
+
+int hugeFlags(HugePageMode Mode, int Flags)
+{
+    return Mode == HugePageMode::Explicit ? Flags : 0;
+}
+
+void adviseHuge(HugePageMode Mode, void *Address, size_t Size)
+{
+    if (Mode == HugePageMode::Transparent)
+        madvise(Address, Size, MADV_HUGEPAGE);
+}
+
+} // namespace
+
+SlabPool::SlabPool(HugePageMode HugePages, size_t ReservationSize)
+    : HugePages(HugePages)
+{
+    // PROT_NONE address space only, slabs are mapped over it
+    size_t Mapped = ReservationSize + SlabSize;
+    void *Base = mmap(nullptr, Mapped, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (Base == MAP_FAILED)
+        return;
+
+    ReservationBase = static_cast<uint8_t *>(Base);
+    ReservationMapped = Mapped;
+    Reservation = reinterpret_cast<uint8_t *>(alignTo(reinterpret_cast<uintptr_t>(Base), SlabSize));
+    this->ReservationSize = ReservationSize;
+}
+
+SlabPool::~SlabPool()
+{
+    for (auto &KindSlabs : Slabs) {
+        for (Slab &S : KindSlabs) {
+            if (S.Writable != S.Address)
+                munmap(S.Writable, S.Size);
+            munmap(S.Address, S.Size);
+        }
+    }
+    if (ReservationBase)
+        munmap(ReservationBase, ReservationMapped);
+}
+
+SlabPool::Extent SlabPool::allocate(Kind K, size_t Size, Align Alignment)
+{
+    Size = alignTo(std::max<size_t>(Size, 1), Granule);
+
+    std::lock_guard Lock(Mutex);
+    for (Slab &S : Slabs[static_cast<size_t>(K)]) {
+        if (Extent E = carve(S, Size, Alignment); E.Address)
+            return E;
+    }
+
+    Slab *S = mapSlab(K, alignTo(Size + Alignment.value(), SlabSize));
+    if (!S)
+        return {};
+    return carve(*S, Size, Alignment);
+}
+
+void SlabPool::release(Kind K, const Extent &E)
+{
+    if (!E.Address)
+        return;
+
+    std::lock_guard Lock(Mutex);
+    for (Slab &S : Slabs[static_cast<size_t>(K)]) {
+        if (E.Address < S.Address || E.Address >= S.Address + S.Size)
+            continue;
+
+        size_t Offset = E.Address - S.Address;
+        size_t Size = E.Size;
+
+        auto Next = S.Free.lower_bound(Offset);
+        if (Next != S.Free.end() && Offset + Size == Next->first) {
+            Size += Next->second;
+            Next = S.Free.erase(Next);
+        }
+        if (Next != S.Free.begin()) {
+            auto Prev = std::prev(Next);
+            if (Prev->first + Prev->second == Offset) {
+                Prev->second += Size;
+                return;
+            }
+        }
+        S.Free.emplace(Offset, Size);
+        return;
+    }
+}
+
+SlabPool::Extent SlabPool::carve(Slab &S, size_t Size, Align Alignment)
+{
+    for (auto It = S.Free.begin(); It != S.Free.end(); ++It) {
+        auto [Offset, FreeSize] = *It;
+        size_t Start = alignTo(reinterpret_cast<uintptr_t>(S.Address) + Offset, Alignment)
+                - reinterpret_cast<uintptr_t>(S.Address);
+        if (Start + Size > Offset + FreeSize)
+            continue;
+
+        S.Free.erase(It);
+        if (Start != Offset)
+            S.Free.emplace(Offset, Start - Offset);
+        if (Start + Size != Offset + FreeSize)
+            S.Free.emplace(Start + Size, Offset + FreeSize - Start - Size);
+        return { S.Address + Start, S.Writable + Start, Size };
+    }
+    return {};
+}
+
+SlabPool::Slab *SlabPool::mapSlab(Kind K, size_t Size)
+{
+    uint8_t *Fixed = reserve(Size);
+    int FixedFlag = Fixed ? MAP_FIXED : 0;
+
+    // the huge page mode first, regular pages if it fails
+    for (HugePageMode Mode : { HugePages, HugePageMode::None }) {
+        void *Address = MAP_FAILED;
+        void *Writable = MAP_FAILED;
+
+        if (K == Kind::Data) {
+            Address = mmap(Fixed, Size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | FixedFlag | hugeFlags(Mode, MAP_HUGETLB), -1, 0);
+            Writable = Address;
+        }
+        else {
+            bool IsCode = K == Kind::Code;
+            int Fd = memfd_create(IsCode ? "shit-jit-code" : "shit-jit-rodata",
+                                  MFD_CLOEXEC | hugeFlags(Mode, MFD_HUGETLB | MFD_HUGE_2MB));
+            if (Fd >= 0 && ftruncate(Fd, Size) == 0) {
+                Address = mmap(Fixed, Size, IsCode ? PROT_READ | PROT_EXEC : PROT_READ,
+                               MAP_SHARED | FixedFlag, Fd, 0);
+                Writable = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+            }
+            if (Fd >= 0)
+                close(Fd);
+        }
+
+        if (Address != MAP_FAILED && Writable != MAP_FAILED) {
+            adviseHuge(Mode, Address, Size);
+            if (Writable != Address)
+                adviseHuge(Mode, Writable, Size);
+            Slabs[static_cast<size_t>(K)].push_back(
+                    { static_cast<uint8_t *>(Address), static_cast<uint8_t *>(Writable), Size, { { 0, Size } } });
+            return &Slabs[static_cast<size_t>(K)].back();
+        }
+
+        if (Writable != MAP_FAILED && Writable != Address)
+            munmap(Writable, Size);
+        if (Address != MAP_FAILED)
+            munmap(Address, Size);
+        if (Mode == HugePageMode::None)
+            break;
+
+        // unmapping gave the reserved range back, reserve it again for the retry
+        if (Fixed && mmap(Fixed, Size, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+            Fixed = nullptr;
+            FixedFlag = 0;
+        }
+        if (Mode == HugePageMode::Explicit) {
+            errs() << "No huge pages left for JIT memory, using regular pages\n";
+            HugePages = HugePageMode::None;
+        }
+    }
+    return nullptr;
+}
+
+uint8_t *SlabPool::reserve(size_t Size)
+{
+    if (!Reservation || ReservationSize - ReservationUsed < Size)
+        return nullptr;
+    uint8_t *Address = Reservation + ReservationUsed;
+    ReservationUsed += Size;
+    return Address;
+}
+
+SlabMemoryManager::~SlabMemoryManager()
+{
+    for (auto &[K, E] : Owned)
+        Pool.release(K, E);
+}
+
+void SlabMemoryManager::reserveAllocationSpace(
+        uintptr_t CodeSize, Align CodeAlign,
+        uintptr_t RODataSize, Align RODataAlign,
+        uintptr_t RWDataSize, Align RWDataAlign)
+{
+    reserve(SlabPool::Kind::Code, Code, CodeSize + CodeAlign.value());
+    reserve(SlabPool::Kind::ReadOnly, ROData, RODataSize + RODataAlign.value());
+    reserve(SlabPool::Kind::Data, RWData, RWDataSize + RWDataAlign.value());
+}
+
+uint8_t *SlabMemoryManager::allocateCodeSection(
+        uintptr_t Size, unsigned Alignment, unsigned, StringRef)
+{
+    SlabPool::Extent E = allocate(SlabPool::Kind::Code, Code, Size, Alignment);
+    if (E.Address)
+        Aliased.emplace_back(SlabPool::Kind::Code, E);
+    return E.Writable;
+}
+
+uint8_t *SlabMemoryManager::allocateDataSection(
+        uintptr_t Size, unsigned Alignment, unsigned, StringRef, bool IsReadOnly)
+{
+    if (!IsReadOnly)
+        return allocate(SlabPool::Kind::Data, RWData, Size, Alignment).Writable;
+
+    SlabPool::Extent E = allocate(SlabPool::Kind::ReadOnly, ROData, Size, Alignment);
+    if (E.Address)
+        Aliased.emplace_back(SlabPool::Kind::ReadOnly, E);
+    return E.Writable;
+}
+
+void SlabMemoryManager::notifyObjectLoaded(RuntimeDyld &RTDyld, const object::ObjectFile &)
+{
+    for (; Remapped != Aliased.size(); ++Remapped) {
+        const SlabPool::Extent &E = Aliased[Remapped].second;
+        RTDyld.mapSectionAddress(E.Writable, reinterpret_cast<uint64_t>(E.Address));
+    }
+}
+
+void SlabMemoryManager::registerEHFrames(uint8_t *, uint64_t LoadAddr, size_t Size)
+{
+    RTDyldMemoryManager::registerEHFrames(reinterpret_cast<uint8_t *>(LoadAddr), LoadAddr, Size);
+}
+
+bool SlabMemoryManager::finalizeMemory(std::string *)
+{
+    for (const auto &[K, E] : Aliased) {
+        if (K == SlabPool::Kind::Code)
+            sys::Memory::InvalidateInstructionCache(E.Address, E.Size);
+    }
+    return false;
+}
+
+void SlabMemoryManager::reserve(SlabPool::Kind K, Block &B, size_t Size)
+{
+    if (Size == 0)
+        return;
+    B.Memory = Pool.allocate(K, Size, Align(Granule));
+    B.Used = 0;
+    if (B.Memory.Address)
+        Owned.emplace_back(K, B.Memory);
+}
+
+SlabPool::Extent SlabMemoryManager::allocate(
+        SlabPool::Kind K, Block &B, uintptr_t Size, unsigned Alignment)
+{
+    Align A(std::max(Alignment, 1u));
+
+    if (B.Memory.Address) {
+        uintptr_t Base = reinterpret_cast<uintptr_t>(B.Memory.Address);
+        size_t Start = alignTo(Base + B.Used, A) - Base;
+        if (Start + Size <= B.Memory.Size) {
+            B.Used = Start + Size;
+            return { B.Memory.Address + Start, B.Memory.Writable + Start, Size };
+        }
+    }
+
+    SlabPool::Extent E = Pool.allocate(K, Size, A);
+    if (E.Address)
+        Owned.emplace_back(K, E);
+    return E;
+}
+
+} // namespace llvm::orc
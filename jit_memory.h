@@ -0,0 +1,153 @@
+#pragma once
+
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/ExecutionEngine/RuntimeDyld.h"
+#include "llvm/Support/Alignment.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace llvm::orc {
+
+enum class HugePageMode : uint8_t {
+    None,
+    // madvise(MADV_HUGEPAGE), the kernel backs slabs with huge pages when it can
+    Transparent,
+    // MAP_HUGETLB from the reserved pool, regular pages once it is empty
+    Explicit,
+};
+
+// Memory of every object linked by RuntimeDyld.
+// Objects get extents of 2 MiB slabs carved out of one address range
+// reservation, so small modules share pages and stay in reach of rel32
+// relocations to each other. Code and read-only data slabs are mapped twice
+// from a memfd: read-execute or read-only where they are used and read-write
+// where the linker writes them, so sections being linked can share a page
+// with ones in use while no used page is ever writable.
+// Released extents are merged with their free neighbours and reused.
+class SlabPool {
+public:
+    static constexpr size_t SlabSize = size_t(2) << 20;
+
+    enum class Kind : uint8_t {
+        Code,
+        ReadOnly,
+        Data,
+    };
+
+    struct Extent {
+        // where it is used
+        uint8_t *Address = nullptr;
+        // where it is written, Address for writable data
+        uint8_t *Writable = nullptr;
+        size_t Size = 0;
+    };
+
+    explicit SlabPool(HugePageMode HugePages, size_t ReservationSize = size_t(1) << 30);
+    ~SlabPool();
+
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    // empty extent if no memory can be mapped
+    Extent allocate(Kind K, size_t Size, Align Alignment);
+
+    void release(Kind K, const Extent &E);
+
+private:
+    struct Slab {
+        uint8_t *Address;
+        uint8_t *Writable;
+        size_t Size;
+
+        // offset -> size of the free ranges
+        std::map<size_t, size_t> Free;
+    };
+
+    // carves Size bytes out of S, empty extent if they do not fit
+    static Extent carve(Slab &S, size_t Size, Align Alignment);
+
+    // nullptr if the memory can not be mapped
+    Slab *mapSlab(Kind K, size_t Size);
+
+    // fixed address for a slab, nullptr once the reservation is used up
+    uint8_t *reserve(size_t Size);
+
+    std::mutex Mutex;
+    HugePageMode HugePages;
+
+    uint8_t *ReservationBase = nullptr;
+    size_t ReservationMapped = 0;
+    uint8_t *Reservation = nullptr;
+    size_t ReservationSize = 0;
+    size_t ReservationUsed = 0;
+
+    std::vector<Slab> Slabs[3];
+};
+
+// RuntimeDyld memory manager of one object. Its sections come from the
+// pool and go back to it when the object is removed with its tracker.
+class SlabMemoryManager : public RTDyldMemoryManager {
+public:
+    explicit SlabMemoryManager(SlabPool &Pool) : Pool(Pool) {}
+    ~SlabMemoryManager() override;
+
+    bool needsToReserveAllocationSpace() override { return true; }
+
+    void reserveAllocationSpace(
+            uintptr_t CodeSize, Align CodeAlign,
+            uintptr_t RODataSize, Align RODataAlign,
+            uintptr_t RWDataSize, Align RWDataAlign) override;
+
+    uint8_t *allocateCodeSection(
+            uintptr_t Size, unsigned Alignment, unsigned SectionID, StringRef SectionName) override;
+
+    // read-only sections are written through an alias, like code
+    uint8_t *allocateDataSection(
+            uintptr_t Size, unsigned Alignment, unsigned SectionID, StringRef SectionName,
+            bool IsReadOnly) override;
+
+    using RTDyldMemoryManager::notifyObjectLoaded;
+
+    // points RuntimeDyld at the views code and read-only data are used from
+    void notifyObjectLoaded(RuntimeDyld &RTDyld, const object::ObjectFile &Obj) override;
+
+    // Registers the frames where they are used, they refer to the code
+    // relative to their own address. Addr is only where they were written.
+    void registerEHFrames(uint8_t *Addr, uint64_t LoadAddr, size_t Size) override;
+
+    bool finalizeMemory(std::string *ErrMsg = nullptr) override;
+
+private:
+    // pool extent handed out by a bump pointer
+    struct Block {
+        SlabPool::Extent Memory;
+        size_t Used = 0;
+    };
+
+    void reserve(SlabPool::Kind K, Block &B, size_t Size);
+
+    // from B while it lasts, then from the pool
+    SlabPool::Extent allocate(SlabPool::Kind K, Block &B, uintptr_t Size, unsigned Alignment);
+
+    SlabPool &Pool;
+    Block Code;
+    Block ROData;
+    Block RWData;
+
+    // everything to give back
+    std::vector<std::pair<SlabPool::Kind, SlabPool::Extent>> Owned;
+
+    // sections written through an alias, the first Remapped of them
+    // already passed to RuntimeDyld
+    std::vector<std::pair<SlabPool::Kind, SlabPool::Extent>> Aliased;
+    size_t Remapped = 0;
+};
+
+} // namespace llvm::orc
@@ -1,3 +1,4 @@
+#include "options.h"
 #include "parser.h"
 
 extern "C" {
@@ -5,8 +6,24 @@ extern "C" {
 }
 
 
-int main()
+int main(int argc, char **argv)
 {
+    if (!Options::parse(argc, argv)) {
+        return 1;
+    }
+
+    if (!Options::get().input.empty()) {
+        auto source = Token::Source::fromFile(Options::get().input);
+        if (!source) {
+            return 1;
+        }
+        auto parser = Parser::Parser(
+                Token::TokenArray::lex(std::move(source), Options::get().jobs),
+                Options::get().jobs);
+        parser.MainLoop();
+        return 0;
+    }
+
     auto parser = Parser::Parser();
     parser.MainLoop();
 }
@@ -0,0 +1,127 @@
+#include "opcode.h"
+
+#include <atomic>
+#include <cctype>
+#include <mutex>
+#include <string>
+
+
+namespace AST {
+
+namespace {
+
+std::array<OperatorInfo, OPCODE_COUNT> __operators = [] {
+    std::array<OperatorInfo, OPCODE_COUNT> table{};
+    for (size_t op = 0; op != BUILTIN_OPCODE_COUNT; ++op) {
+        const auto &binop = Token::binopTable[opcodeTokens[op]];
+        table[op] = { binop.precedence, binop.assoc, binop.spelling };
+    }
+    return table;
+}();
+
+// opcode of every user-defined operator char, 0 if there is none.
+// Published after its __operators entry is filled.
+std::array<std::atomic<uint8_t>, 128> __userOpcodes{};
+size_t __nextOpcode = BUILTIN_OPCODE_COUNT;
+std::mutex __mutex;
+
+} // namespace
+
+bool canBeOperator(char symbol)
+{
+    auto sym = static_cast<unsigned char>(symbol);
+    return sym < __userOpcodes.size()
+        && std::isgraph(sym)
+        && !std::isalnum(sym)
+        && sym != '#'
+        && Token::classifySymbol(symbol) == Token::UNKNOWN;
+}
+
+const OperatorInfo &getOperator(Opcode op)
+{
+    return __operators[static_cast<size_t>(op)];
+}
+
+int getPrecedence(Opcode op)
+{
+    return op == Opcode::INVALID ? -1 : getOperator(op).precedence;
+}
+
+std::string_view getSpelling(Opcode op)
+{
+    return op == Opcode::INVALID ? "<invalid>" : getOperator(op).spelling;
+}
+
+Opcode findOperator(char symbol)
+{
+    auto sym = static_cast<unsigned char>(symbol);
+    if (sym >= __userOpcodes.size()) {
+        return Opcode::INVALID;
+    }
+    uint8_t op = __userOpcodes[sym].load(std::memory_order_acquire);
+    return op == 0 ? Opcode::INVALID : static_cast<Opcode>(op);
+}
+
+Opcode defineOperator(char symbol, int precedence)
+{
+    if (!canBeOperator(symbol)) {
+        return Opcode::INVALID;
+    }
+
+    std::lock_guard lock(__mutex);
+    auto &slot = __userOpcodes[static_cast<unsigned char>(symbol)];
+    if (uint8_t op = slot.load(std::memory_order_relaxed)) {
+        // redefinition, binds with the new precedence from here on
+        __operators[op].precedence = precedence;
+        return static_cast<Opcode>(op);
+    }
+
+    auto op = __nextOpcode++;
+    Symbol::Id function = Symbol::intern(std::string("binary") + symbol);
+    __operators[op] = {
+        .precedence = precedence,
+        .assoc = Token::Assoc::LEFT,
+        .spelling = Symbol::name(function).substr(6),
+        .function = function,
+    };
+    slot.store(static_cast<uint8_t>(op), std::memory_order_release);
+    return static_cast<Opcode>(op);
+}
+
+std::optional<int64_t> evaluate(Opcode op, int64_t lhs, int64_t rhs)
+{
+    auto ulhs = static_cast<uint64_t>(lhs);
+    auto urhs = static_cast<uint64_t>(rhs);
+
+    switch (op) {
+        case Opcode::ADD:        return static_cast<int64_t>(ulhs + urhs);
+        case Opcode::SUB:        return static_cast<int64_t>(ulhs - urhs);
+        case Opcode::MUL:        return static_cast<int64_t>(ulhs * urhs);
+        case Opcode::BIT_AND:    return lhs & rhs;
+        case Opcode::BIT_OR:     return lhs | rhs;
+        case Opcode::LESS:       return lhs < rhs;
+        case Opcode::GREATER:    return lhs > rhs;
+        case Opcode::LESS_EQ:    return lhs <= rhs;
+        case Opcode::GREATER_EQ: return lhs >= rhs;
+        case Opcode::EQ:         return lhs == rhs;
+        case Opcode::NOT_EQ:     return lhs != rhs;
+        case Opcode::AND:        return lhs && rhs;
+        case Opcode::OR:         return lhs || rhs;
+        case Opcode::DIV:
+        case Opcode::MOD:
+            if (rhs == 0 || (lhs == INT64_MIN && rhs == -1)) {
+                return std::nullopt;
+            }
+            return op == Opcode::DIV ? lhs / rhs : lhs % rhs;
+        case Opcode::SHL:
+        case Opcode::SHR:
+            if (rhs < 0 || rhs > 63) {
+                return std::nullopt;
+            }
+            return op == Opcode::SHL ? static_cast<int64_t>(ulhs << rhs) : lhs >> rhs;
+        default:
+            return std::nullopt;
+    }
+}
+
+} // namespace AST
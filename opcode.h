@@ -0,0 +1,120 @@
+#pragma once
+
+#include "symbol.h"
+#include "tokenizer.h"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+
+namespace AST {
+
+// Binary operators, loosest binding first.
+// User-defined operators get the opcodes from USER on.
+enum class Opcode : uint8_t {
+    ASSIGN,
+    OR,
+    AND,
+    BIT_OR,
+    BIT_AND,
+    EQ,
+    NOT_EQ,
+    LESS,
+    GREATER,
+    LESS_EQ,
+    GREATER_EQ,
+    SHL,
+    SHR,
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+
+    BUILTIN_COUNT,
+    USER = BUILTIN_COUNT,
+
+    INVALID = UINT8_MAX,
+};
+
+constexpr size_t OPCODE_COUNT = static_cast<size_t>(Opcode::INVALID);
+constexpr size_t BUILTIN_OPCODE_COUNT = static_cast<size_t>(Opcode::BUILTIN_COUNT);
+
+// token of every builtin opcode
+constexpr std::array<Token::TokenType, BUILTIN_OPCODE_COUNT> opcodeTokens = {
+    Token::ASSIGN,
+    Token::OR,
+    Token::AND,
+    Token::BIT_OR,
+    Token::BIT_AND,
+    Token::EQ,
+    Token::NOT_EQ,
+    Token::LESS,
+    Token::GREATER,
+    Token::LESS_EQ,
+    Token::GREATER_EQ,
+    Token::SHL,
+    Token::SHR,
+    Token::PLUS,
+    Token::MINUS,
+    Token::MUL,
+    Token::DIV,
+    Token::MOD,
+};
+
+constexpr auto tokenOpcodes = [] {
+    std::array<Opcode, Token::TOKEN_COUNT> table{};
+    table.fill(Opcode::INVALID);
+    for (size_t op = 0; op != opcodeTokens.size(); ++op) {
+        table[opcodeTokens[op]] = static_cast<Opcode>(op);
+    }
+    return table;
+}();
+
+// builtin opcode of a token, Opcode::INVALID for the rest
+constexpr Opcode toOpcode(Token::TokenType token)
+{
+    return tokenOpcodes[token];
+}
+
+constexpr bool isUserOperator(Opcode op)
+{
+    return op >= Opcode::USER && op != Opcode::INVALID;
+}
+
+struct OperatorInfo {
+    int precedence = -1;
+    Token::Assoc assoc = Token::Assoc::LEFT;
+    std::string_view spelling;
+
+    // user-defined operators are calls of 'binary<spelling>'
+    Symbol::Id function = 0;
+};
+
+// Builtins and user-defined operators share one table.
+// An operator is defined once the code of its function is generated,
+// in source order: files that define operators are never parsed in chunks.
+const OperatorInfo &getOperator(Opcode op);
+
+// -1 for Opcode::INVALID
+int getPrecedence(Opcode op);
+
+std::string_view getSpelling(Opcode op);
+
+// user-defined operator spelled `symbol`, Opcode::INVALID if there is none
+Opcode findOperator(char symbol);
+
+// chars lexed as a lone UNKNOWN token
+bool canBeOperator(char symbol);
+
+// Registers a user-defined operator or changes its precedence.
+// Opcode::INVALID if `symbol` can not be an operator.
+Opcode defineOperator(char symbol, int precedence);
+
+// builtin operator with the same result as the generated code,
+// nullopt if it would trap or be poison or `op` is not foldable
+std::optional<int64_t> evaluate(Opcode op, int64_t lhs, int64_t rhs);
+
+} // namespace AST
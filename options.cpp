@@ -0,0 +1,97 @@
+#include "options.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <string_view>
+#include <thread>
+
+
+namespace Options {
+
+namespace {
+
+Settings settings;
+
+void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-O0|-O1|-O2|-O3|-Os] [--mcpu CPU] [--mattr FEATURES] [--print-target]"
+                    " [--no-lazy] [--jitlink] [--link-stats]"
+                    " [--huge-pages none|transparent|explicit] [--jobs N] [file]\n", argv0);
+}
+
+} // namespace
+
+const Settings &get()
+{
+    return settings;
+}
+
+bool parse(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "-O0" || arg == "-O1" || arg == "-O2" || arg == "-O3") {
+            settings.optLevel = static_cast<OptLevel>(arg[2] - '0');
+        }
+        else if (arg == "-Os") {
+            settings.optLevel = OptLevel::Os;
+        }
+        else if (arg == "--mcpu" && i + 1 < argc) {
+            settings.cpu = argv[++i];
+        }
+        else if (arg == "--mattr" && i + 1 < argc) {
+            settings.features = argv[++i];
+        }
+        else if (arg == "--print-target") {
+            settings.printTarget = true;
+        }
+        else if (arg == "--no-lazy") {
+            settings.lazy = false;
+        }
+        else if (arg == "--jitlink") {
+            settings.jitLink = true;
+        }
+        else if (arg == "--link-stats") {
+            settings.linkStats = true;
+        }
+        else if (arg == "--huge-pages" && i + 1 < argc) {
+            std::string_view value = argv[++i];
+            if (value == "none") {
+                settings.hugePages = HugePages::None;
+            }
+            else if (value == "transparent") {
+                settings.hugePages = HugePages::Transparent;
+            }
+            else if (value == "explicit") {
+                settings.hugePages = HugePages::Explicit;
+            }
+            else {
+                usage(argv[0]);
+                return false;
+            }
+        }
+        else if (arg == "--jobs" && i + 1 < argc) {
+            std::string_view value = argv[++i];
+            auto [end, err] = std::from_chars(value.data(), value.data() + value.size(), settings.jobs);
+            if (err != std::errc() || end != value.data() + value.size() || settings.jobs == 0) {
+                usage(argv[0]);
+                return false;
+            }
+        }
+        else if (arg.starts_with("-") || !settings.input.empty()) {
+            usage(argv[0]);
+            return false;
+        }
+        else {
+            settings.input = arg;
+        }
+    }
+
+    if (settings.jobs == 0) {
+        settings.jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return true;
+}
+
+} // namespace Options
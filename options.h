@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+
+namespace Options {
+
+// -O flags, O2 by default
+enum class OptLevel : uint8_t {
+    O0,
+    O1,
+    O2,
+    O3,
+    Os,
+};
+
+// pages behind JIT code and data, transparent huge pages by default
+enum class HugePages : uint8_t {
+    None,
+    Transparent,
+    Explicit,
+};
+
+// Command line of the session.
+struct Settings {
+    // program file, stdin if empty
+    std::string input;
+
+    // threads for the front end, all cores by default,
+    // with more than one the JIT compiles on threads of its own too
+    unsigned jobs = 0;
+
+    OptLevel optLevel = OptLevel::O2;
+
+    // JIT target CPU and extra features ("+avx2,-bmi2"),
+    // the host ones when the CPU is empty or "native"
+    std::string cpu;
+    std::string features;
+
+    // print the CPU and features the JIT generates code for
+    bool printTarget = false;
+
+    // compile functions on their first call, not when they are looked up
+    bool lazy = true;
+
+    // link JIT objects with JITLink instead of RuntimeDyld
+    bool jitLink = false;
+
+    // print the time spent linking JIT objects at the end
+    bool linkStats = false;
+
+    HugePages hugePages = HugePages::Transparent;
+};
+
+const Settings &get();
+
+// Fills get() from argv, prints the usage and returns false on bad arguments.
+bool parse(int argc, char **argv);
+
+} // namespace Options
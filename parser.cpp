@@ -4,11 +4,16 @@
 #include "jit.h"
 
 #include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
 
+#include <algorithm>
+#include <cctype>
 #include <cstdint>
+#include <future>
 #include <map>
 #include <string>
 
@@ -16,21 +21,52 @@
 namespace Parser {
 
 Parser::Parser()
-    : token_(Token::END, nullptr)
+    : tokens_(std::make_shared<Token::TokenArray>(
+            Token::TokenArray::stream(Token::Source::fromStdin())))
 { }
 
-std::unique_ptr<AST::ExpressionAST> Parser::parseValue()
+Parser::Parser(Token::TokenArray tokens, unsigned jobs)
+    : tokens_(std::make_shared<Token::TokenArray>(std::move(tokens))),
+      jobs_(jobs)
+{ }
+
+Parser::Parser(std::shared_ptr<Token::TokenArray> tokens, size_t pos)
+    : tokens_(std::move(tokens)),
+      pos_(pos)
+{ }
+
+AST::ExpressionAST *Parser::parseValue()
 {
-    if (getTokenName() == "-") {
+    bool negative = false;
+    if (peek() == Token::MINUS) {
         getToken(); // eject '-'
-        *getTokenData<int64_t>() *= -1;
+        if (peek() == Token::INVALID) {
+            return logInvalidToken();
+        }
+        if (peek() != Token::INT) {
+            return AST::LogError("Expected number after '-'");
+        }
+        negative = true;
+    }
+    int64_t value = tokens_->value(pos_);
+    if (value == INT64_MIN && !negative) {
+        // 2^63 is a mask in 0x../0b.., but out of range in decimal
+        auto text = tokens_->text(pos_);
+        if (text.size() < 2 || !std::isalpha(static_cast<unsigned char>(text[1]))) {
+            std::string msg = "integer literal is out of range: ";
+            msg += text;
+            return AST::LogError(msg.c_str());
+        }
+    }
+    if (negative) {
+        value = static_cast<int64_t>(0 - static_cast<uint64_t>(value));
     }
-    auto result = std::make_unique<AST::ValueAST>(*getTokenData<int64_t>());
+    auto result = arena_.make<AST::ValueAST>(value);
     getToken();
     return result;
 }
 
-std::unique_ptr<AST::ExpressionAST> Parser::parseParentheses()
+AST::ExpressionAST *Parser::parseParentheses()
 {
     getToken(); // eject '('
 
@@ -39,7 +75,7 @@ std::unique_ptr<AST::ExpressionAST> Parser::parseParentheses()
         return nullptr;
     }
 
-    if (getTokenName() != ")") {
+    if (peek() != Token::RPAREN) {
         return AST::LogError("Expected ')' in expression");
     }
     getToken(); // eject ')'
@@ -47,31 +83,34 @@ std::unique_ptr<AST::ExpressionAST> Parser::parseParentheses()
     return expr;
 }
 
-std::unique_ptr<AST::ExpressionAST> Parser::parseIdentifier()
+AST::ExpressionAST *Parser::parseIdentifier()
 {
-    auto name = getTokenName();
+    Symbol::Id name = tokens_->symbol(pos_);
     getToken();
-    if (getTokenName() != "(") { // not a 'call'
-        return std::make_unique<AST::VarAST>(name);
+    if (peek() != Token::LPAREN) { // not a 'call'
+        if (std::ranges::find(scope_, name) == scope_.end()) {
+            unresolved_ = true;
+        }
+        return arena_.make<AST::VarAST>(name);
     }
     getToken(); // eject '('
 
     // 'call'
-    std::vector<std::unique_ptr<AST::ExpressionAST>> args;
-    if (getTokenName() != ")") {
+    std::vector<AST::ExpressionAST *> args;
+    if (peek() != Token::RPAREN) {
         while (true) {
             auto arg = parseExpression();
             if (arg) {
-                args.push_back(std::move(arg));
+                args.push_back(arg);
             }
             else {
                 return nullptr;
             }
 
-            if (getTokenName() == ")")
+            if (peek() == Token::RPAREN)
                 break;
 
-            if (getTokenName() != ",")
+            if (peek() != Token::COMMA)
                 return AST::LogError("Expected ')' or ',' in argument list");
 
             getToken();
@@ -79,107 +118,170 @@ std::unique_ptr<AST::ExpressionAST> Parser::parseIdentifier()
     }
 
     getToken(); // eject ')'
-    return std::make_unique<AST::CallExprAST>(name, std::move(args));
+    calls_.emplace_back(name, args.size());
+    return arena_.make<AST::CallExprAST>(name, arena_.copy(args));
 }
 
-std::unique_ptr<AST::ExpressionAST> Parser::parsePrimary()
+AST::ExpressionAST *Parser::parsePrimary()
 {
-    if (getTokenName() == "(") {
+    if (peek() == Token::LPAREN) {
         return parseParentheses();
     }
-    if (token_.first == Token::INT || getTokenName() == "-") {
+    if (peek() == Token::INT || peek() == Token::MINUS) {
         return parseValue();
     }
-    if (token_.first == Token::IF) {
+    if (peek() == Token::IF) {
         return parseIfElse();
     }
-    if (token_.first == Token::FOR) {
+    if (peek() == Token::FOR) {
         return parseFor();
     }
-    if (token_.first == Token::IDENT) { // all getTokenName checks before this
+    if (peek() == Token::VAR) {
+        return parseVarIn();
+    }
+    if (peek() == Token::IDENT) {
         return parseIdentifier();
     }
+    if (peek() == Token::INVALID) {
+        return logInvalidToken();
+    }
     return AST::LogError("Unknown token when expecting an expression");
 }
 
-std::unique_ptr<AST::ExpressionAST> Parser::parseExpression()
+AST::ExpressionAST *Parser::parseExpression()
 {
-    auto lhs = parsePrimary();
-    if (!lhs) {
-        return nullptr;
-    }
-    return parseRhsBinOp(0, std::move(lhs));
-}
+    // Operator precedence parsing with explicit stacks, so neither long
+    // operator chains nor deeply nested parentheses grow the native stack.
+    // Opcode::INVALID on the operator stack stands for an open '('.
+    llvm::SmallVector<AST::ExpressionAST *, 16> operands;
+    llvm::SmallVector<AST::Opcode, 16> operators;
+    size_t openParens = 0;
+
+    // merges operands of the operators on top that bind tighter than `prec`,
+    // or as tight when the next one is left associative
+    auto reduce = [&](int prec, bool rightAssoc) {
+        while (!operators.empty() && operators.back() != AST::Opcode::INVALID) {
+            int topPrec = AST::getPrecedence(operators.back());
+            if (topPrec < prec || (topPrec == prec && rightAssoc)) {
+                break;
+            }
+            auto rhs = operands.pop_back_val();
+            auto lhs = operands.pop_back_val();
+            operands.push_back(arena_.make<AST::BinaryExprAST>(
+                operators.pop_back_val(),
+                lhs,
+                rhs));
+        }
+    };
 
-std::unique_ptr<AST::ExpressionAST> Parser::parseRhsBinOp(
-        int exprPrec,
-        std::unique_ptr<AST::ExpressionAST> lhs)
-{
-    // parse rhs while operators precedence lower than current op
     while (true) {
-        int prec = Token::getTokenPrecedence(getTokenName());
-
-        if (prec < exprPrec)
-            return lhs;
-
-        std::string op = getTokenName();
-        getToken();
+        while (peek() == Token::LPAREN) {
+            getToken(); // eject '('
+            operators.push_back(AST::Opcode::INVALID);
+            ++openParens;
+        }
 
-        auto rhs = parsePrimary();
-        if (!rhs) {
+        auto operand = parsePrimary();
+        if (!operand) {
             return nullptr;
         }
+        operands.push_back(operand);
 
-        int nextPrecedence = Token::getTokenPrecedence(getTokenName());
-        if (exprPrec < nextPrecedence) {
-            rhs = parseRhsBinOp(exprPrec + 1, std::move(rhs));
-            if (!rhs) {
-                return nullptr;
-            }
+        while (openParens != 0 && peek() == Token::RPAREN) {
+            reduce(-1, false);
+            operators.pop_back(); // '('
+            --openParens;
+            getToken(); // eject ')'
         }
 
-        // merge lhs(op)rhs
-        lhs = std::make_unique<AST::BinaryExprAST>(op, std::move(lhs), std::move(rhs));
+        auto op = peekOpcode();
+        if (op == AST::Opcode::INVALID) {
+            break;
+        }
+        reduce(AST::getPrecedence(op), AST::getOperator(op).assoc == Token::Assoc::RIGHT);
+        operators.push_back(op);
+        getToken(); // eject op
+    }
+
+    if (openParens != 0) {
+        return AST::LogError("Expected ')' in expression");
     }
-    return lhs;
+    reduce(-1, false);
+    return operands.back();
 }
 
 std::unique_ptr<AST::PrototypeAST> Parser::parsePrototype()
 {
-    std::string name = getTokenName();
-    if (name.empty()) {
+    Symbol::Id name = 0;
+    int precedence = 0;
+
+    if (peek() == Token::BINARY) {
+        getToken(); // eject 'binary'
+        if (AST::toOpcode(peek()) != AST::Opcode::INVALID) {
+            return AST::LogErrorP("Builtin operators can not be redefined");
+        }
+        if (peek() != Token::UNKNOWN || tokens_->text(pos_).size() != 1) {
+            return AST::LogErrorP("Expected operator after 'binary'");
+        }
+        char opSymbol = tokens_->text(pos_)[0];
+        if (!AST::canBeOperator(opSymbol)) {
+            return AST::LogErrorP("Invalid operator");
+        }
+        name = Symbol::intern(std::string("binary") + opSymbol);
+        getToken(); // eject operator
+
+        precedence = DEFAULT_PRECEDENCE;
+        if (peek() == Token::INT) {
+            if (tokens_->value(pos_) < 1 || tokens_->value(pos_) > 100) {
+                return AST::LogErrorP("Invalid precedence: must be 1..100");
+            }
+            precedence = tokens_->value(pos_);
+            getToken(); // eject precedence
+        }
+    }
+    else if (peek() == Token::IDENT) {
+        name = tokens_->symbol(pos_);
+        getToken(); // eject name
+    }
+    else {
         return AST::LogErrorP("Expected function name in prototype");
     }
 
-    getToken(); // eject name
-    if (getTokenName() != "(") {
+    if (peek() != Token::LPAREN) {
         return AST::LogErrorP("Expected '(' in prototype");
     }
     getToken(); // eject '('
 
-    std::vector<std::string> args;
-    while (getTokenName() != ")") {
-        args.push_back(getTokenName());
+    std::vector<Symbol::Id> args;
+    while (peek() != Token::RPAREN) {
+        if (peek() != Token::IDENT) {
+            return AST::LogErrorP("Expected argument name in prototype");
+        }
+        args.push_back(tokens_->symbol(pos_));
 
         // eject ','
         getToken();
-        auto token = getTokenName();
-        if (token == ")") {
+        if (peek() == Token::RPAREN) {
             break;
         }
-        if (token != ",") {
-            std::string msg = "Expected ',' between args in args list prototype, found: " + token;
+        if (peek() != Token::COMMA) {
+            std::string msg = "Expected ',' between args in args list prototype, found: ";
+            msg += tokens_->text(pos_);
             return AST::LogErrorP(msg.c_str());
         }
         getToken();
     }
 
-    if (getTokenName() != ")") {
+    if (peek() != Token::RPAREN) {
         return AST::LogErrorP("Expected ')' in prototype");
     }
 
     getToken(); // eject ')'
-    return std::make_unique<AST::PrototypeAST>(std::move(name), std::move(args));
+
+    if (precedence > 0 && args.size() != 2) {
+        return AST::LogErrorP("Invalid number of operands for operator");
+    }
+    return std::make_unique<AST::PrototypeAST>(name, std::move(args), precedence);
 }
 
 std::unique_ptr<AST::FunctionAST> Parser::parseDefinition()
@@ -190,12 +292,16 @@ std::unique_ptr<AST::FunctionAST> Parser::parseDefinition()
     if (!proto) {
         return nullptr;
     }
+    scope_ = proto->getArgs();
+    unresolved_ = false;
+    calls_.clear();
     auto body = parseExpression();
     if (!body) {
         return nullptr;
     }
 
-    return std::make_unique<AST::FunctionAST>(std::move(proto), std::move(body));
+    return std::make_unique<AST::FunctionAST>(
+        std::move(proto), body, !unresolved_, std::move(calls_));
 }
 
 std::unique_ptr<AST::PrototypeAST> Parser::parseExtern()
@@ -204,7 +310,7 @@ std::unique_ptr<AST::PrototypeAST> Parser::parseExtern()
     return parsePrototype();
 }
 
-std::unique_ptr<AST::ExpressionAST> Parser::parseIfElse()
+AST::ExpressionAST *Parser::parseIfElse()
 {
     getToken(); // eject 'if'
 
@@ -214,7 +320,7 @@ std::unique_ptr<AST::ExpressionAST> Parser::parseIfElse()
         return nullptr;
     }
 
-    if (getTokenName() != ":") {
+    if (peek() != Token::COLON) {
         return AST::LogError("Expected ':' after if statement\n");
     }
     getToken(); // eject ':'
@@ -224,8 +330,8 @@ std::unique_ptr<AST::ExpressionAST> Parser::parseIfElse()
         return nullptr;
     }
 
-    std::unique_ptr<AST::ExpressionAST> elseExpr = nullptr;
-    if (token_.first == Token::ELSE) {
+    AST::ExpressionAST *elseExpr = nullptr;
+    if (peek() == Token::ELSE) {
         getToken(); // eject 'else'
         elseExpr = parseExpression();
         if (!elseExpr) {
@@ -237,27 +343,27 @@ std::unique_ptr<AST::ExpressionAST> Parser::parseIfElse()
         return AST::LogError("Expected 'else'\n");
     }
 
-    return std::make_unique<AST::IfElseExpressionAST>(
-        std::move(condExpr),
-        std::move(thenExpr),
-        std::move(elseExpr));
+    return arena_.make<AST::IfElseExpressionAST>(
+        condExpr,
+        thenExpr,
+        elseExpr);
 }
 
-std::unique_ptr<AST::ExpressionAST> Parser::parseFor()
+AST::ExpressionAST *Parser::parseFor()
 {
     getToken(); // eject 'for'
-    if (getTokenName() != "(") {
+    if (peek() != Token::LPAREN) {
         return AST::LogError("Expected '(' after for.\n");
     }
     getToken(); // eject '('
 
-    std::string iterName = getTokenName();
-    if (iterName.empty()) {
+    if (peek() != Token::IDENT) {
         return AST::LogError("Expected iterator name in for expression.\n");
     }
+    Symbol::Id iterName = tokens_->symbol(pos_);
     getToken();
 
-    if (getTokenName() != "=") {
+    if (peek() != Token::ASSIGN) {
         return AST::LogError("Expected '=' after iterator name.\n");
     }
     getToken(); // eject '='
@@ -266,18 +372,21 @@ std::unique_ptr<AST::ExpressionAST> Parser::parseFor()
     if (!startExpr) {
         return nullptr;
     }
-    if (getTokenName() != ";") {
+    if (peek() != Token::SEMICOLON) {
         return AST::LogError("Expected ';' after start statement in for.\n");
     }
     getToken(); // eject ';'
 
+    // the rest sees the iterator
+    scope_.push_back(iterName);
+
     auto endExpr = parseExpression();
     if (!endExpr) {
         return nullptr;
     }
 
-    std::unique_ptr<AST::ExpressionAST> stepExpr;
-    if (getTokenName() == ";") {
+    AST::ExpressionAST *stepExpr = nullptr;
+    if (peek() == Token::SEMICOLON) {
         getToken(); // eject ';'
         stepExpr = parseExpression();
         if (!stepExpr) {
@@ -285,7 +394,7 @@ std::unique_ptr<AST::ExpressionAST> Parser::parseFor()
         }
     }
 
-    if (getTokenName() != ")") {
+    if (peek() != Token::RPAREN) {
         return AST::LogError("Expected ')' after for statement.\n");
     }
     getToken(); // eject ')'
@@ -294,17 +403,70 @@ std::unique_ptr<AST::ExpressionAST> Parser::parseFor()
     if (!body) {
         return nullptr;
     }
+    scope_.pop_back();
 
-    return std::make_unique<AST::ForExpressionAST>(
-            std::move(iterName),
-            std::move(startExpr),
-            std::move(endExpr),
-            std::move(stepExpr),
-            std::move(body));
+    return arena_.make<AST::ForExpressionAST>(
+            iterName,
+            startExpr,
+            endExpr,
+            stepExpr,
+            body);
+}
+
+AST::ExpressionAST *Parser::parseVarIn()
+{
+    getToken(); // eject 'var'
+
+    std::vector<Symbol::Id> names;
+    std::vector<AST::ExpressionAST *> inits;
+    size_t scopeMark = scope_.size();
+    while (true) {
+        if (peek() != Token::IDENT) {
+            return AST::LogError("Expected variable name after 'var'");
+        }
+        names.push_back(tokens_->symbol(pos_));
+        getToken(); // eject name
+
+        // 0 by default
+        AST::ExpressionAST *init = nullptr;
+        if (peek() == Token::ASSIGN) {
+            getToken(); // eject '='
+            init = parseExpression();
+            if (!init) {
+                return nullptr;
+            }
+        }
+        inits.push_back(init ? init : arena_.make<AST::ValueAST>(0));
+        scope_.push_back(names.back());
+
+        if (peek() != Token::COMMA) {
+            break;
+        }
+        getToken(); // eject ','
+    }
+
+    if (peek() != Token::IN) {
+        return AST::LogError("Expected 'in' after 'var'");
+    }
+    getToken(); // eject 'in'
+
+    auto body = parseExpression();
+    if (!body) {
+        return nullptr;
+    }
+    scope_.resize(scopeMark);
+
+    return arena_.make<AST::VarInExpressionAST>(
+            arena_.copy(names),
+            arena_.copy(inits),
+            body);
 }
 
 std::unique_ptr<AST::FunctionAST> Parser::parseTopLevelExpr()
 {
+    scope_.clear();
+    unresolved_ = false;
+    calls_.clear();
     auto expr = parseExpression();
     // if (isAssigment(expr)) {
     //     debug(0, "ASSIGMENT");
@@ -314,80 +476,215 @@ std::unique_ptr<AST::FunctionAST> Parser::parseTopLevelExpr()
         return nullptr;
     }
     debug(0, "ADD ANON EXPR");
-    auto proto = std::make_unique<AST::PrototypeAST>("__anon_expr", std::vector<std::string>());
-    return std::make_unique<AST::FunctionAST>(std::move(proto), std::move(expr));
+    auto proto = std::make_unique<AST::PrototypeAST>(
+        Symbol::intern("__anon_expr"),
+        std::vector<Symbol::Id>());
+    return std::make_unique<AST::FunctionAST>(
+        std::move(proto), expr, !unresolved_, std::move(calls_));
 }
 
-void Parser::HandleDefinition()
+Parser::Item Parser::parseItem()
 {
-    auto funcAST = parseDefinition();
-    funcAST->debugPrint();
-    if (funcAST) {
-        auto *funcIR = funcAST->codeGen();
-        if (funcIR) {
-            fprintf(stderr, "Read function definition:\n");
-            funcIR->print(llvm::errs());
-            fprintf(stderr, "\n");
-
-            Context::IRManager::onErr(
-                Context::IRManager::getJIT()->addModule(
-                    llvm::orc::ThreadSafeModule(
-                        Context::IRManager::moveModule(),
-                        Context::IRManager::moveCtx())));
-
-            Context::IRManager::reinit();
+    Item item;
+    switch (peek()) {
+        case Token::END:
+            item.kind = Item::END;
+            return item;
+        case Token::FUNC:
+            item.kind = Item::DEFINITION;
+            item.function = parseDefinition();
+            break;
+        case Token::EXT:
+            item.kind = Item::EXTERN;
+            item.proto = parseExtern();
+            break;
+        case Token::SEMICOLON:
+            item.kind = Item::EMPTY;
+            getToken();
+            return item;
+        default:
+            item.kind = Item::EXPRESSION;
+            item.function = parseTopLevelExpr();
+            break;
+    }
+
+    if (!item.function && !item.proto) {
+        getToken(); // skip the offending token
+    }
+    return item;
+}
+
+void Parser::parseItems(size_t end, std::vector<Item> &items)
+{
+    while (pos_ < end) {
+        std::string errors;
+        AST::redirectErrors(&errors);
+        items.push_back(parseItem());
+        AST::redirectErrors(nullptr);
+        items.back().errors = std::move(errors);
+    }
+}
+
+std::vector<size_t> Parser::findChunks() const
+{
+    auto types = tokens_->types();
+    if (jobs_ < 2 || types.size() < 2 * MIN_CHUNK_TOKENS) {
+        return {};
+    }
+
+    // A user operator changes how the tokens after its definition parse,
+    // chunk parsers would not see it, so files that define one go in order.
+    auto rest = types.subspan(pos_);
+    if (std::ranges::find(rest, Token::BINARY) != rest.end()) {
+        return {};
+    }
+
+    // Items start at 'fun', 'extern' and after ';' outside of parentheses,
+    // so chunks can be parsed separately.
+    size_t target = std::max(MIN_CHUNK_TOKENS, types.size() / (jobs_ * 4));
+    size_t end = types.size() - 1; // END
+    std::vector<size_t> borders{ pos_ };
+    int depth = 0;
+    for (size_t i = pos_; i < end; ++i) {
+        if (types[i] == Token::LPAREN) {
+            ++depth;
+        }
+        else if (types[i] == Token::RPAREN) {
+            depth = std::max(depth - 1, 0);
+        }
+
+        if (depth != 0 || i - borders.back() < target) {
+            continue;
+        }
+        if (types[i] == Token::FUNC || types[i] == Token::EXT) {
+            borders.push_back(i);
+        }
+        else if (types[i] == Token::SEMICOLON) {
+            borders.push_back(i + 1);
         }
     }
-    else {
-        getToken();
+    if (borders.back() != end) {
+        borders.push_back(end);
     }
+    return borders;
 }
 
-void Parser::HandleExtern()
+void Parser::parseChunks(const std::vector<size_t> &borders)
 {
-    auto protoAST = parseExtern();
-    protoAST->debugPrint();
-    if (protoAST) {
-        auto *funcIR = protoAST->codeGen();
-        if (funcIR) {
-            fprintf(stderr, "Read extern:\n");
-            funcIR->print(llvm::errs());
-            fprintf(stderr, "\n");
-            Context::IRManager::getFunctionProtos()[protoAST->getName()] = std::move(protoAST);
+    struct Chunk {
+        std::unique_ptr<Parser> parser;
+        std::vector<Item> items;
+    };
+    std::vector<Chunk> chunks(borders.size() - 1);
+    std::vector<std::shared_future<void>> parsed;
+
+    llvm::ThreadPool pool(llvm::hardware_concurrency(jobs_));
+    for (size_t i = 0; i != chunks.size(); ++i) {
+        chunks[i].parser = std::unique_ptr<Parser>(new Parser(tokens_, borders[i]));
+        parsed.push_back(pool.async([&chunk = chunks[i], end = borders[i + 1]] {
+            chunk.parser->parseItems(end, chunk.items);
+        }));
+    }
+
+    // codegen stays in source order
+    for (size_t i = 0; i != chunks.size(); ++i) {
+        parsed[i].wait();
+        for (auto &item : chunks[i].items) {
+            HandleItem(std::move(item));
+            arena_.reset(); // nodes made by folding
+            fprintf(stderr, "post> ");
         }
+        chunks[i] = {}; // releases the nodes
     }
-    else {
-        getToken();
+    pos_ = borders.back();
+}
+
+void Parser::HandleDefinition(std::unique_ptr<AST::FunctionAST> funcAST)
+{
+    if (!funcAST) {
+        return;
+    }
+    funcAST->fold(arena_);
+    funcAST->debugPrint();
+    auto *funcIR = funcAST->codeGen();
+    if (funcIR) {
+        fprintf(stderr, "Read function definition:\n");
+        funcIR->print(llvm::errs());
+        fprintf(stderr, "\n");
+
+        Context::IRManager::onErr(
+            Context::IRManager::getJIT()->addLazyModule(
+                llvm::orc::ThreadSafeModule(
+                    Context::IRManager::moveModule(),
+                    Context::IRManager::moveCtx())));
+
+        Context::IRManager::reinit();
+    }
+}
+
+void Parser::HandleExtern(std::unique_ptr<AST::PrototypeAST> protoAST)
+{
+    if (!protoAST) {
+        return;
+    }
+    protoAST->debugPrint();
+    auto *funcIR = protoAST->codeGen();
+    if (funcIR) {
+        fprintf(stderr, "Read extern:\n");
+        funcIR->print(llvm::errs());
+        fprintf(stderr, "\n");
+        protoAST->registerOperator();
+        Context::IRManager::getFunctionProtos()[protoAST->getName()] = std::move(protoAST);
     }
 }
 
-void Parser::HandleTopLevelExpression()
+void Parser::HandleTopLevelExpression(std::unique_ptr<AST::FunctionAST> funcAST)
 {
-    auto funcAST = parseTopLevelExpr();
+    if (!funcAST) {
+        return;
+    }
+    funcAST->fold(arena_);
     funcAST->debugPrint();
-    if (funcAST) {
-        if (funcAST->codeGen()) {
-            auto retType = Context::IRManager::getJIT()->getMainJITDylib().createResourceTracker();
 
-            auto tsm = llvm::orc::ThreadSafeModule(
-                Context::IRManager::moveModule(),
-                Context::IRManager::moveCtx());
+    // folded to a constant, nothing to compile
+    if (auto *value = llvm::dyn_cast<AST::ValueAST>(funcAST->getBody())) {
+        fprintf(stderr, "Evaluated to %ld\n", value->getValue());
+        return;
+    }
+
+    if (funcAST->codeGen()) {
+        auto retType = Context::IRManager::getJIT()->getMainJITDylib().createResourceTracker();
 
-            Context::IRManager::onErr(
-                    Context::IRManager::getJIT()->addModule(std::move(tsm), retType));
-            Context::IRManager::reinit();
+        auto tsm = llvm::orc::ThreadSafeModule(
+            Context::IRManager::moveModule(),
+            Context::IRManager::moveCtx());
 
-            auto exprSymbol = Context::IRManager::onErr(
-                Context::IRManager::getJIT()->lookup("__anon_expr"));
+        Context::IRManager::onErr(
+                Context::IRManager::getJIT()->addModule(std::move(tsm), retType));
+        Context::IRManager::reinit();
 
-            int64_t (*intPtr)() = exprSymbol.toPtr<int64_t (*)()>();
-            fprintf(stderr, "Evaluated to %ld\n", intPtr());
+        auto exprSymbol = Context::IRManager::onErr(
+            Context::IRManager::getJIT()->lookup("__anon_expr"));
 
-            Context::IRManager::onErr(retType->remove());
-        }
+        int64_t (*intPtr)() = exprSymbol.toPtr<int64_t (*)()>();
+        fprintf(stderr, "Evaluated to %ld\n", intPtr());
+
+        Context::IRManager::onErr(retType->remove());
     }
-    else {
-        getToken();
+}
+
+void Parser::HandleItem(Item item)
+{
+    fputs(item.errors.c_str(), stderr);
+
+    if (item.kind == Item::DEFINITION) {
+        HandleDefinition(std::move(item.function));
+    }
+    else if (item.kind == Item::EXTERN) {
+        HandleExtern(std::move(item.proto));
+    }
+    else if (item.kind == Item::EXPRESSION) {
+        HandleTopLevelExpression(std::move(item.function));
     }
 }
 
@@ -405,29 +702,26 @@ void Parser::MainLoop()
     Context::IRManager::reinit();
 
     fprintf(stderr, "post> ");
-    getToken();
+
+    auto borders = findChunks();
+    if (borders.size() > 2) {
+        parseChunks(borders);
+    }
 
     while (true) {
-        if (token_.first == Token::END) {
+        tokens_->discard(pos_);
+        Item item = parseItem();
+        if (item.kind == Item::END) {
             fprintf(stderr, "\n==== done ====\n");
+            if (Options::get().linkStats) {
+                Context::IRManager::printLinkStats();
+            }
             return;
         }
-        else if (token_.first == Token::FUNC) {
-            HandleDefinition();
-        }
-        else if (token_.first == Token::EXT) {
-            HandleExtern();
-        }
-        else if (getTokenName() == ";") {
-            getToken();
-        }
-        else {
-            HandleTopLevelExpression();
-        }
+        HandleItem(std::move(item));
+        arena_.reset();
         fprintf(stderr, "post> ");
     }
-
-    Context::IRManager::getModule()->print(llvm::errs(), nullptr);
 }
 
 } // namespace Parser
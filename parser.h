@@ -1,23 +1,30 @@
 #pragma once
 
 #include "ast.h"
-#include "tokenizer.h"
+#include "token_array.h"
 
+#include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 
 namespace Parser {
 
 class Parser {
 public:
+    // reads stdin
     Parser();
 
+    // top-level items are parsed on `jobs` threads when there are many of them
+    explicit Parser(Token::TokenArray tokens, unsigned jobs = 1);
+
     // number
-    std::unique_ptr<AST::ExpressionAST> parseValue();
+    AST::ExpressionAST *parseValue();
 
     // parentheses
     // seq('(', optional(@expression), ')')
-    std::unique_ptr<AST::ExpressionAST> parseParentheses();
+    AST::ExpressionAST *parseParentheses();
 
     // identifier | call
     // @identifier
@@ -27,26 +34,28 @@ public:
     //          repeat(
     //              seq(@identifier, optional(','))),
     //          ')')
-    std::unique_ptr<AST::ExpressionAST> parseIdentifier();
+    AST::ExpressionAST *parseIdentifier();
 
     // primary
     // choice(@identifier,
     //        @call,
     //        @number,
-    //        @parentheses)
-    std::unique_ptr<AST::ExpressionAST> parsePrimary();
+    //        @parentheses,
+    //        @if,
+    //        @for,
+    //        @var)
+    AST::ExpressionAST *parsePrimary();
 
     // expression
     // seq(@expression, @bin_op, @expression)
-    std::unique_ptr<AST::ExpressionAST> parseExpression();
-
-    std::unique_ptr<AST::ExpressionAST> parseRhsBinOp(
-        int exprPrec,
-        std::unique_ptr<AST::ExpressionAST> lhs);
+    // parentheses and operators are parsed without recursion
+    AST::ExpressionAST *parseExpression();
 
     // @prototype
     // seq(
-    //     @identifier
+    //     choice(
+    //         @identifier,
+    //         seq('binary', @operator, optional(@number))),
     //     '(',
     //     repeat(
     //         seq(@identifier, optional(','))),
@@ -74,7 +83,7 @@ public:
     // optional(
     //      'else',
     //      @expression))
-    std::unique_ptr<AST::ExpressionAST> parseIfElse();
+    AST::ExpressionAST *parseIfElse();
 
     // for
     // seq(
@@ -83,17 +92,27 @@ public:
     //      @expression,
     //      optional(';', @expression),
     //      ')')
-    std::unique_ptr<AST::ExpressionAST> parseFor();
+    AST::ExpressionAST *parseFor();
+
+    // var/in
+    // seq(
+    //      'var',
+    //      @identifier, optional('=', @expression),
+    //      repeat(
+    //          seq(',', @identifier, optional('=', @expression))),
+    //      'in',
+    //      @expression)
+    AST::ExpressionAST *parseVarIn();
 
     // @expression
     std::unique_ptr<AST::FunctionAST> parseTopLevelExpr();
 
     // ---- Handlers
-    void HandleDefinition();
+    void HandleDefinition(std::unique_ptr<AST::FunctionAST> funcAST);
 
-    void HandleExtern();
+    void HandleExtern(std::unique_ptr<AST::PrototypeAST> protoAST);
 
-    void HandleTopLevelExpression();
+    void HandleTopLevelExpression(std::unique_ptr<AST::FunctionAST> funcAST);
 
     // top
     // choice(
@@ -103,36 +122,97 @@ public:
     void MainLoop();
 
 private:
-    Token::TokenData getToken()
+    // tokens per chunk at least, smaller ones are not worth a task
+    static constexpr size_t MIN_CHUNK_TOKENS = 4096;
+
+    // of user-defined operators
+    static constexpr int DEFAULT_PRECEDENCE = 30;
+
+    // parsed top-level item, handled later in source order
+    struct Item {
+        enum Kind {
+            END,
+            EMPTY,
+            DEFINITION,
+            EXTERN,
+            EXPRESSION,
+        };
+
+        Kind kind = END;
+        std::unique_ptr<AST::FunctionAST> function;
+        std::unique_ptr<AST::PrototypeAST> proto;
+
+        // parse errors, printed when the item is handled
+        std::string errors;
+    };
+
+    // parser of one chunk, starting at `pos`
+    Parser(std::shared_ptr<Token::TokenArray> tokens, size_t pos);
+
+    Item parseItem();
+
+    // parses items starting before `end`
+    void parseItems(size_t end, std::vector<Item> &items);
+
+    // borders of chunks of items from pos_ to the END,
+    // empty if the rest is not worth splitting or defines operators
+    std::vector<size_t> findChunks() const;
+
+    void parseChunks(const std::vector<size_t> &borders);
+
+    void HandleItem(Item item);
+
+    // kind of the token `ahead` positions after the current one
+    Token::TokenType peek(size_t ahead = 0)
     {
-        Token::freeToken(token_);
-        token_ = tokenizer_.getToken();
-        return token_;
+        return tokens_->type(pos_ + ahead);
     }
 
-    template <class T>
-    T* getTokenData() const
+    // opcode of the current token, INVALID if it is not a binary operator
+    AST::Opcode peekOpcode()
     {
-        return static_cast<T*>(token_.second);
+        if (peek() == Token::UNKNOWN) {
+            auto text = tokens_->text(pos_);
+            return text.size() == 1 ? AST::findOperator(text[0]) : AST::Opcode::INVALID;
+        }
+        return AST::toOpcode(peek());
     }
 
-    std::string getTokenName() const
+    void getToken()
     {
-        if (token_.first != Token::IDENT) {
-            return {};
-        }
-        return *getTokenData<std::string>();
+        ++pos_;
     }
 
-    bool isAssigment(const std::unique_ptr<AST::ExpressionAST>& expr)
+    AST::ExpressionAST *logInvalidToken()
     {
-        auto binExpr = dynamic_cast<AST::BinaryExprAST*>(expr.get());
+        std::string msg = tokens_->error(pos_);
+        msg += ": ";
+        msg += tokens_->text(pos_);
+        return AST::LogError(msg.c_str());
+    }
+
+    bool isAssigment(AST::ExpressionAST *expr)
+    {
+        auto *binExpr = llvm::dyn_cast<AST::BinaryExprAST>(expr);
         return binExpr != nullptr
-            && binExpr->getOp() == "=";
+            && binExpr->getOpcode() == AST::Opcode::ASSIGN;
     }
 
-    Token::Tokenizer tokenizer_;
-    Token::TokenData token_;
+    std::shared_ptr<Token::TokenArray> tokens_;
+    // current token
+    size_t pos_ = 0;
+
+    unsigned jobs_ = 1;
+
+    // Names in scope in the body being parsed, innermost last, whether
+    // the body uses one that is not, and its calls. They decide if the
+    // body can be folded.
+    std::vector<Symbol::Id> scope_;
+    bool unresolved_ = false;
+    std::vector<std::pair<Symbol::Id, size_t>> calls_;
+
+    // nodes of the current top-level item, released after its codegen
+    AST::Arena arena_;
 };
 
 } // namespace Parser
@@ -0,0 +1,196 @@
+#include "scan.h"
+
+#include <cctype>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#else
+#define SCAN_X86 0
+#endif
+
+
+namespace Token::Scan {
+
+namespace {
+
+using ScanFn = const char *(*)(const char *, const char *);
+
+struct Scanners {
+    ScanFn skipSpaces;
+    ScanFn skipLine;
+    ScanFn skipAlnum;
+};
+
+// ---- Scalar
+
+bool isSpace(char c) { return std::isspace(static_cast<unsigned char>(c)); }
+bool isLine(char c) { return c != '\n' && c != '\r'; }
+bool isAlnum(char c) { return std::isalnum(static_cast<unsigned char>(c)); }
+
+template <bool (*Pred)(char)>
+const char *scalarSkip(const char *cur, const char *end)
+{
+    while (cur != end && Pred(*cur)) {
+        ++cur;
+    }
+    return cur;
+}
+
+constexpr Scanners scalar = {
+    scalarSkip<isSpace>,
+    scalarSkip<isLine>,
+    scalarSkip<isAlnum>,
+};
+
+#if SCAN_X86
+
+// Byte masks are built with signed compares, so bytes >= 0x80
+// never match, same as the C locale classifiers.
+
+// ---- SSE2, 16 bytes per step
+
+__m128i inRange16(__m128i c, char lo, char hi)
+{
+    return _mm_and_si128(
+        _mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)),
+        _mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
+}
+
+__m128i spaceMask16(__m128i c)
+{
+    return _mm_or_si128(
+        _mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+        inRange16(c, '\t', '\r'));
+}
+
+__m128i lineMask16(__m128i c)
+{
+    return _mm_andnot_si128(
+        _mm_or_si128(
+            _mm_cmpeq_epi8(c, _mm_set1_epi8('\n')),
+            _mm_cmpeq_epi8(c, _mm_set1_epi8('\r'))),
+        _mm_set1_epi8(-1));
+}
+
+__m128i alnumMask16(__m128i c)
+{
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    return _mm_or_si128(
+        inRange16(c, '0', '9'),
+        inRange16(lower, 'a', 'z'));
+}
+
+template <__m128i (*Mask)(__m128i), bool (*Pred)(char)>
+const char *sse2Skip(const char *cur, const char *end)
+{
+    while (end - cur >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cur));
+        unsigned miss = ~_mm_movemask_epi8(Mask(chunk)) & 0xFFFF;
+        if (miss != 0) {
+            return cur + __builtin_ctz(miss);
+        }
+        cur += 16;
+    }
+    return scalarSkip<Pred>(cur, end);
+}
+
+constexpr Scanners sse2 = {
+    sse2Skip<spaceMask16, isSpace>,
+    sse2Skip<lineMask16, isLine>,
+    sse2Skip<alnumMask16, isAlnum>,
+};
+
+// ---- AVX2, 32 bytes per step
+
+#define SCAN_AVX2 __attribute__((target("avx2")))
+
+SCAN_AVX2 __m256i inRange32(__m256i c, char lo, char hi)
+{
+    return _mm256_and_si256(
+        _mm256_cmpgt_epi8(c, _mm256_set1_epi8(lo - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), c));
+}
+
+SCAN_AVX2 __m256i spaceMask32(__m256i c)
+{
+    return _mm256_or_si256(
+        _mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')),
+        inRange32(c, '\t', '\r'));
+}
+
+SCAN_AVX2 __m256i lineMask32(__m256i c)
+{
+    return _mm256_andnot_si256(
+        _mm256_or_si256(
+            _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')),
+            _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\r'))),
+        _mm256_set1_epi8(-1));
+}
+
+SCAN_AVX2 __m256i alnumMask32(__m256i c)
+{
+    __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(
+        inRange32(c, '0', '9'),
+        inRange32(lower, 'a', 'z'));
+}
+
+template <__m256i (*Mask)(__m256i), ScanFn Tail>
+SCAN_AVX2 const char *avx2Skip(const char *cur, const char *end)
+{
+    while (end - cur >= 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(cur));
+        unsigned miss = ~static_cast<unsigned>(_mm256_movemask_epi8(Mask(chunk)));
+        if (miss != 0) {
+            return cur + __builtin_ctz(miss);
+        }
+        cur += 32;
+    }
+    return Tail(cur, end);
+}
+
+constexpr Scanners avx2 = {
+    avx2Skip<spaceMask32, sse2.skipSpaces>,
+    avx2Skip<lineMask32, sse2.skipLine>,
+    avx2Skip<alnumMask32, sse2.skipAlnum>,
+};
+
+#undef SCAN_AVX2
+
+#endif // SCAN_X86
+
+const Scanners &select()
+{
+#if SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return sse2;
+    }
+#endif
+    return scalar;
+}
+
+const Scanners &__scanners = select();
+
+} // namespace
+
+const char *skipSpaces(const char *cur, const char *end)
+{
+    return __scanners.skipSpaces(cur, end);
+}
+
+const char *skipLine(const char *cur, const char *end)
+{
+    return __scanners.skipLine(cur, end);
+}
+
+const char *skipAlnum(const char *cur, const char *end)
+{
+    return __scanners.skipAlnum(cur, end);
+}
+
+} // namespace Token::Scan
@@ -0,0 +1,20 @@
+#pragma once
+
+
+namespace Token::Scan {
+
+// Character-class scans over [cur, end) for the Tokenizer hot loops.
+// Each returns the first byte that does not belong to the class,
+// or `end` if the whole range does.
+// SSE2/AVX2 versions are picked at startup, scalar ones elsewhere.
+
+// std::isspace
+const char *skipSpaces(const char *cur, const char *end);
+
+// anything but '\n' and '\r'
+const char *skipLine(const char *cur, const char *end);
+
+// std::isalnum
+const char *skipAlnum(const char *cur, const char *end);
+
+} // namespace Token::Scan
@@ -0,0 +1,105 @@
+#include "source.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace Token {
+
+std::unique_ptr<Source> Source::fromStdin()
+{
+    auto source = std::unique_ptr<Source>(new Source());
+    source->streamed_ = true;
+    return source;
+}
+
+std::unique_ptr<Source> Source::fromString(std::string_view text)
+{
+    auto source = std::unique_ptr<Source>(new Source());
+    source->data_ = text.data();
+    source->size_ = text.size();
+    return source;
+}
+
+std::unique_ptr<Source> Source::fromFile(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", path.c_str(), std::strerror(errno));
+        return nullptr;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+        fprintf(stderr, "Cannot stat %s: %s\n", path.c_str(), std::strerror(errno));
+        ::close(fd);
+        return nullptr;
+    }
+
+    auto source = std::unique_ptr<Source>(new Source());
+    if (st.st_size == 0) {
+        ::close(fd);
+        return source;
+    }
+
+    void *map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Cannot mmap %s: %s\n", path.c_str(), std::strerror(errno));
+        return nullptr;
+    }
+    ::madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    source->map_ = map;
+    source->mapSize_ = st.st_size;
+    source->data_ = static_cast<const char*>(map);
+    source->size_ = st.st_size;
+    return source;
+}
+
+Source::~Source()
+{
+    if (map_ != nullptr) {
+        ::munmap(map_, mapSize_);
+    }
+}
+
+bool Source::refill(const char *&keep, const char *&cur)
+{
+    if (!streamed_ || eof_) {
+        return false;
+    }
+
+    // move kept tail to the front of the buffer
+    size_t kept = end() - keep;
+    size_t curOffset = cur - keep;
+    if (kept != 0) {
+        std::memmove(buffer_.data(), keep, kept);
+    }
+
+    buffer_.resize(kept + BLOCK_SIZE);
+    ssize_t n = 0;
+    do {
+        n = ::read(STDIN_FILENO, buffer_.data() + kept, BLOCK_SIZE);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        eof_ = true;
+        n = 0;
+    }
+    buffer_.resize(kept + n);
+
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    keep = data_;
+    cur = data_ + curOffset;
+    return n > 0;
+}
+
+} // namespace Token
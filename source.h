@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+
+namespace Token {
+
+// Contiguous program text for the Tokenizer.
+// Files are mmapped and in-memory sources are borrowed as is, so the whole
+// text is available up front. Stdin is pulled in big blocks instead.
+class Source {
+public:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    static std::unique_ptr<Source> fromStdin();
+    static std::unique_ptr<Source> fromString(std::string_view text);
+    static std::unique_ptr<Source> fromFile(const std::string& path);
+
+    ~Source();
+
+    Source(const Source&) = delete;
+    Source& operator=(const Source&) = delete;
+
+    const char *begin() const { return data_; }
+    const char *end() const { return data_ + size_; }
+
+    // Reads the next block of a streamed source.
+    // Everything before `keep` may be dropped, `keep` and `cur` are
+    // moved along with the kept bytes. Returns false on EOF.
+    bool refill(const char *&keep, const char *&cur);
+
+private:
+    Source() = default;
+
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+
+    // mmapped file
+    void *map_ = nullptr;
+    size_t mapSize_ = 0;
+
+    // streamed stdin
+    bool streamed_ = false;
+    bool eof_ = false;
+    std::string buffer_;
+};
+
+} // namespace Token
@@ -0,0 +1,52 @@
+#include "symbol.h"
+
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace Symbol {
+
+namespace {
+// deque never moves its strings, so views into them stay valid
+std::deque<std::string> __storage;
+std::vector<std::string_view> __names;
+std::unordered_map<std::string_view, Id> __ids;
+
+// parsers of different chunks intern from several threads
+std::shared_mutex __mutex;
+} // namespace
+
+Id intern(std::string_view name)
+{
+    {
+        std::shared_lock lock(__mutex);
+        auto it = __ids.find(name);
+        if (it != __ids.end()) {
+            return it->second;
+        }
+    }
+
+    std::unique_lock lock(__mutex);
+    auto it = __ids.find(name);
+    if (it != __ids.end()) {
+        return it->second;
+    }
+
+    std::string_view stored = __storage.emplace_back(name);
+    Id id = static_cast<Id>(__names.size());
+    __names.push_back(stored);
+    __ids.emplace(stored, id);
+    return id;
+}
+
+std::string_view name(Id id)
+{
+    std::shared_lock lock(__mutex);
+    return __names[id];
+}
+
+} // namespace Symbol
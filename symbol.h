@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+
+namespace Symbol {
+
+// Interned identifier. Every distinct name gets one id for the
+// whole session, so names compare and hash as integers.
+using Id = uint32_t;
+
+Id intern(std::string_view name);
+
+// stays valid for the whole session
+std::string_view name(Id id);
+
+} // namespace Symbol
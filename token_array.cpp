@@ -0,0 +1,172 @@
+#include "token_array.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <unordered_map>
+
+
+namespace Token {
+
+TokenArray TokenArray::lex(std::unique_ptr<Source> source, unsigned jobs)
+{
+    TokenArray tokens;
+    std::string_view text(source->begin(), source->end() - source->begin());
+    tokens.source_ = std::move(source);
+
+    if (text.size() > UINT32_MAX) {
+        fprintf(stderr, "Source is too big to lex: %zu bytes\n", text.size());
+        tokens.push({ .type = END }, 0);
+        return tokens;
+    }
+
+    // Chunks start right after a line end. Only comments run to the
+    // line end, so no token or comment crosses a border.
+    size_t chunks = std::clamp<size_t>(text.size() / MIN_CHUNK, 1, std::max(jobs, 1u));
+    std::vector<std::string_view> parts;
+    size_t begin = 0;
+    for (size_t i = 1; i < chunks; ++i) {
+        size_t border = text.find('\n', std::max(begin, text.size() / chunks * i));
+        if (border == std::string_view::npos) {
+            break;
+        }
+        parts.push_back(text.substr(begin, border + 1 - begin));
+        begin = border + 1;
+    }
+    parts.push_back(text.substr(begin));
+
+    std::vector<TokenArray> lexed;
+    lexed.reserve(parts.size());
+    for (size_t part = 0; part != parts.size(); ++part) {
+        lexed.push_back(TokenArray());
+    }
+    // Parts number their names locally, in the order they first appear.
+    // They are interned part by part after the join, so the ids are the
+    // ones a single pass over the file would give.
+    std::vector<std::vector<std::string_view>> names(parts.size());
+    auto lexPart = [&](size_t part) {
+        std::unordered_map<std::string_view, Symbol::Id> local;
+        Tokenizer tokenizer(Source::fromString(parts[part]), false);
+        for (auto token = tokenizer.getToken(); token.type != END; token = tokenizer.getToken()) {
+            if (token.type == IDENT) {
+                auto [it, added] = local.try_emplace(token.text, names[part].size());
+                if (added) {
+                    names[part].push_back(token.text);
+                }
+                token.symbol = it->second;
+            }
+            lexed[part].push(token, token.text.data() - text.data());
+        }
+    };
+
+    {
+        std::vector<std::jthread> threads;
+        for (size_t part = 1; part < parts.size(); ++part) {
+            threads.emplace_back(lexPart, part);
+        }
+        lexPart(0);
+    }
+
+    std::vector<Symbol::Id> symbols;
+    for (size_t part = 0; part != lexed.size(); ++part) {
+        symbols.clear();
+        for (auto name : names[part]) {
+            symbols.push_back(Symbol::intern(name));
+        }
+        tokens.append(std::move(lexed[part]), symbols);
+    }
+    tokens.push({ .type = END }, text.size());
+    return tokens;
+}
+
+TokenArray TokenArray::stream(std::unique_ptr<Source> source)
+{
+    TokenArray tokens;
+    tokens.tokenizer_ = std::make_unique<Tokenizer>(std::move(source));
+    return tokens;
+}
+
+std::string_view TokenArray::text(size_t index)
+{
+    auto [offset, size] = spans_[at(index)];
+    return std::string_view(base() + offset, size);
+}
+
+void TokenArray::discard(size_t index)
+{
+    if (!tokenizer_ || index <= first_) {
+        return;
+    }
+
+    size_t count = std::min(index - first_, types_.size());
+    types_.erase(types_.begin(), types_.begin() + count);
+    payloads_.erase(payloads_.begin(), payloads_.begin() + count);
+    spans_.erase(spans_.begin(), spans_.begin() + count);
+    first_ += count;
+
+    // drop the lexemes too, the rest of the tokens are rebased
+    uint32_t dropped = spans_.empty() ? streamed_.size() : spans_.front().first;
+    streamed_.erase(0, dropped);
+    for (auto &span : spans_) {
+        span.first -= dropped;
+    }
+}
+
+void TokenArray::lexUpTo(size_t index)
+{
+    if (!tokenizer_) {
+        return;
+    }
+
+    while (first_ + types_.size() <= index
+            && (types_.empty() || types_.back() != END)) {
+        auto token = tokenizer_->getToken();
+        size_t offset = streamed_.size();
+        streamed_ += token.text;
+        push(token, offset);
+    }
+}
+
+void TokenArray::push(const TokenData &token, size_t offset)
+{
+    int64_t payload = 0;
+    if (token.type == INT) {
+        payload = token.value;
+    }
+    else if (token.type == IDENT) {
+        payload = token.symbol;
+    }
+    else if (token.type == INVALID) {
+        payload = errors_.size();
+        errors_.push_back(token.error);
+    }
+
+    types_.push_back(token.type);
+    payloads_.push_back(payload);
+    spans_.emplace_back(offset, token.text.size());
+}
+
+void TokenArray::append(TokenArray &&other, std::span<const Symbol::Id> symbols)
+{
+    // symbols and error indices are local to the chunk
+    for (size_t i = 0; i != other.types_.size(); ++i) {
+        if (other.types_[i] == IDENT) {
+            other.payloads_[i] = symbols[other.payloads_[i]];
+        }
+        else if (other.types_[i] == INVALID) {
+            other.payloads_[i] += errors_.size();
+        }
+    }
+
+    types_.insert(types_.end(), other.types_.begin(), other.types_.end());
+    payloads_.insert(payloads_.end(), other.payloads_.begin(), other.payloads_.end());
+    spans_.insert(spans_.end(), other.spans_.begin(), other.spans_.end());
+    errors_.insert(errors_.end(), other.errors_.begin(), other.errors_.end());
+}
+
+const char *TokenArray::base() const
+{
+    return tokenizer_ ? streamed_.data() : source_->begin();
+}
+
+} // namespace Token
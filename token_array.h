@@ -0,0 +1,96 @@
+#pragma once
+
+#include "source.h"
+#include "symbol.h"
+#include "tokenizer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+namespace Token {
+
+// Tokens of a program packed in parallel arrays (kind, span, payload),
+// indexed by position, so the parser can look ahead as far as it wants.
+// Files are lexed up front, big ones in chunks on several threads.
+// Stdin is lexed on demand as the parser looks ahead.
+class TokenArray {
+public:
+    // chunks smaller than that are not worth a thread
+    static constexpr size_t MIN_CHUNK = 256 * 1024;
+
+    static TokenArray lex(std::unique_ptr<Source> source, unsigned jobs);
+
+    static TokenArray stream(std::unique_ptr<Source> source);
+
+    TokenArray(TokenArray&&) = default;
+    TokenArray& operator=(TokenArray&&) = default;
+
+    // Indices past the end read as END.
+    TokenType type(size_t index) { return types_[at(index)]; }
+
+    // INT
+    int64_t value(size_t index) { return payloads_[at(index)]; }
+
+    // IDENT
+    Symbol::Id symbol(size_t index) { return static_cast<Symbol::Id>(payloads_[at(index)]); }
+
+    // INVALID
+    const char *error(size_t index) { return errors_[payloads_[at(index)]]; }
+
+    // all tokens lexed so far
+    std::span<const TokenType> types() const { return types_; }
+
+    // Valid until the next token is lexed or discard() is called,
+    // streamed lexemes live in a buffer that grows.
+    std::string_view text(size_t index);
+
+    // Streamed tokens before `index` will not be read again.
+    // Lexed files keep all of them, so they can be parsed again.
+    void discard(size_t index);
+
+private:
+    TokenArray() = default;
+
+    size_t at(size_t index)
+    {
+        if (index - first_ >= types_.size()) [[unlikely]] {
+            lexUpTo(index);
+            return std::min(index - first_, types_.size() - 1);
+        }
+        return index - first_;
+    }
+
+    void lexUpTo(size_t index);
+
+    // offset is relative to the start of base()
+    void push(const TokenData &token, size_t offset);
+
+    // IDENT payloads of `other` index `symbols`
+    void append(TokenArray &&other, std::span<const Symbol::Id> symbols);
+
+    const char *base() const;
+
+    // lexed file
+    std::unique_ptr<Source> source_;
+
+    // streamed tokens and their lexemes
+    std::unique_ptr<Tokenizer> tokenizer_;
+    std::string streamed_;
+    size_t first_ = 0;
+
+    std::vector<TokenType> types_;
+    // INT value, IDENT symbol or INVALID index in errors_
+    std::vector<int64_t> payloads_;
+    // offset and size of the lexeme
+    std::vector<std::pair<uint32_t, uint32_t>> spans_;
+    std::vector<const char *> errors_;
+};
+
+} // namespace Token
@@ -1,39 +1,158 @@
 #include "tokenizer.h"
+#include "scan.h"
 
-#include <algorithm>
+#include <array>
+#include <cstdint>
 
 
 namespace Token {
 
 namespace {
 
-bool isInt(const std::string& str)
+// 0-35 for [0-9a-z], -1 for anything that can not be a part of a literal
+int digitValue(char sym)
 {
-    return std::find_if(str.begin(), str.end(),
-                [](char c) { return !std::isdigit(c); }
-            ) == str.end();
+    if (sym >= '0' && sym <= '9') {
+        return sym - '0';
+    }
+    char lower = sym | 0x20;
+    if (lower >= 'a' && lower <= 'z') {
+        return lower - 'a' + 10;
+    }
+    return -1;
 }
 
-} // namespace
+struct Keyword {
+    std::string_view name;
+    TokenType type;
+};
 
-int getTokenPrecedence(const std::string& token)
+constexpr Keyword keywords[] = {
+    { "fun",    FUNC   },
+    { "extern", EXT    },
+    { "ret",    RET    },
+    { "binary", BINARY },
+    { "if",     IF     },
+    { "else",   ELSE   },
+    { "for",    FOR    },
+    { "var",    VAR    },
+    { "in",     IN     },
+};
+
+// Keywords are told apart by first two chars, last char and length
+// packed into one word, then hashed multiplicatively into a small
+// table. The multiplier is searched at compile time, so adding a
+// keyword never needs retuning and lookup stays one hash + one compare.
+constexpr unsigned KEYWORD_TABLE_BITS = 5;
+constexpr size_t KEYWORD_TABLE_SIZE = size_t(1) << KEYWORD_TABLE_BITS;
+
+static_assert(std::size(keywords) <= KEYWORD_TABLE_SIZE / 2,
+              "keyword table is too dense, raise KEYWORD_TABLE_BITS");
+
+constexpr uint32_t keywordKey(std::string_view word)
 {
-    if (binopPrecedence.contains(token)) {
-        return binopPrecedence.at(token);
+    return static_cast<uint32_t>(static_cast<unsigned char>(word[0]))
+        | static_cast<uint32_t>(static_cast<unsigned char>(word[1])) << 8
+        | static_cast<uint32_t>(static_cast<unsigned char>(word.back())) << 16
+        | static_cast<uint32_t>(word.size()) << 24;
+}
+
+constexpr size_t keywordSlot(uint32_t seed, std::string_view word)
+{
+    return (keywordKey(word) * seed) >> (32 - KEYWORD_TABLE_BITS);
+}
+
+constexpr uint32_t findKeywordSeed()
+{
+    for (uint32_t seed = 0x9E3779B1; seed != 0x9E3779B1 + (1 << 20); seed += 2) {
+        std::array<bool, KEYWORD_TABLE_SIZE> used{};
+        bool ok = true;
+        for (const auto& keyword : keywords) {
+            auto slot = keywordSlot(seed, keyword.name);
+            ok = ok && !used[slot];
+            used[slot] = true;
+        }
+        if (ok) {
+            return seed;
+        }
     }
-    return -1;
+    return 0;
 }
 
-void freeToken(TokenData token)
+constexpr uint32_t KEYWORD_SEED = findKeywordSeed();
+static_assert(KEYWORD_SEED != 0, "no perfect hash for keywords, raise KEYWORD_TABLE_BITS");
+
+constexpr auto keywordTable = [] {
+    std::array<Keyword, KEYWORD_TABLE_SIZE> table{};
+    for (auto& slot : table) {
+        slot = { {}, IDENT };
+    }
+    for (const auto& keyword : keywords) {
+        table[keywordSlot(KEYWORD_SEED, keyword.name)] = keyword;
+    }
+    return table;
+}();
+
+// IDENT for anything that is not a keyword
+TokenType classifyWord(std::string_view word)
 {
-    if (token.first == TokenType::IDENT) {
-        delete static_cast<std::string*>(token.second);
+    if (word.size() < 2) {
+        return IDENT;
     }
-    if (token.first == TokenType::INT) {
-        delete static_cast<int64_t*>(token.second);
+    const auto& slot = keywordTable[keywordSlot(KEYWORD_SEED, word)];
+    return slot.name == word ? slot.type : IDENT;
+}
+
+constexpr auto symbolTable = [] {
+    std::array<TokenType, 128> table{};
+    for (auto& type : table) {
+        type = UNKNOWN;
+    }
+    table['('] = LPAREN;
+    table[')'] = RPAREN;
+    table[','] = COMMA;
+    table[';'] = SEMICOLON;
+    table[':'] = COLON;
+
+    table['='] = ASSIGN;
+    table['<'] = LESS;
+    table['>'] = GREATER;
+    table['+'] = PLUS;
+    table['-'] = MINUS;
+    table['*'] = MUL;
+    table['/'] = DIV;
+    table['%'] = MOD;
+    table['&'] = BIT_AND;
+    table['|'] = BIT_OR;
+    return table;
+}();
+
+// two char operators, UNKNOWN if `first` and `second` do not make one
+constexpr TokenType classifyPair(char first, char second)
+{
+    switch (first) {
+        case '<':   return second == '=' ? LESS_EQ
+                         : second == '<' ? SHL
+                         : UNKNOWN;
+        case '>':   return second == '=' ? GREATER_EQ
+                         : second == '>' ? SHR
+                         : UNKNOWN;
+        case '=':   return second == '=' ? EQ : UNKNOWN;
+        case '!':   return second == '=' ? NOT_EQ : UNKNOWN;
+        case '&':   return second == '&' ? AND : UNKNOWN;
+        case '|':   return second == '|' ? OR : UNKNOWN;
+        default:    return UNKNOWN;
     }
 }
 
+} // namespace
+
+TokenType classifySymbol(char sym)
+{
+    auto index = static_cast<unsigned char>(sym);
+    return index < symbolTable.size() ? symbolTable[index] : UNKNOWN;
+}
+
 std::string tokenToString(TokenType token)
 {
     switch (token) {
@@ -41,108 +160,237 @@ std::string tokenToString(TokenType token)
         case FUNC   :   return "TOKEN : FUNC";
         case EXT    :   return "TOKEN : EXT";
         case RET    :   return "TOKEN : RET";
+        case BINARY :   return "TOKEN : BINARY";
         case INT    :   return "TOKEN : INT";
         case IDENT  :   return "TOKEN : IDENT";
         case IF     :   return "TOKEN : IF";
         case ELSE   :   return "TOKEN : ELSE";
         case FOR    :   return "TOKEN : FOR";
+        case VAR    :   return "TOKEN : VAR";
+        case IN     :   return "TOKEN : IN";
+        case LPAREN     :   return "TOKEN : LPAREN";
+        case RPAREN     :   return "TOKEN : RPAREN";
+        case COMMA      :   return "TOKEN : COMMA";
+        case SEMICOLON  :   return "TOKEN : SEMICOLON";
+        case COLON      :   return "TOKEN : COLON";
+        case ASSIGN     :   return "TOKEN : ASSIGN";
+        case LESS       :   return "TOKEN : LESS";
+        case GREATER    :   return "TOKEN : GREATER";
+        case PLUS       :   return "TOKEN : PLUS";
+        case MINUS      :   return "TOKEN : MINUS";
+        case LESS_EQ    :   return "TOKEN : LESS_EQ";
+        case GREATER_EQ :   return "TOKEN : GREATER_EQ";
+        case EQ         :   return "TOKEN : EQ";
+        case NOT_EQ     :   return "TOKEN : NOT_EQ";
+        case AND        :   return "TOKEN : AND";
+        case OR         :   return "TOKEN : OR";
+        case BIT_AND    :   return "TOKEN : BIT_AND";
+        case BIT_OR     :   return "TOKEN : BIT_OR";
+        case SHL        :   return "TOKEN : SHL";
+        case SHR        :   return "TOKEN : SHR";
+        case MUL        :   return "TOKEN : MUL";
+        case DIV        :   return "TOKEN : DIV";
+        case MOD        :   return "TOKEN : MOD";
+        case UNKNOWN    :   return "TOKEN : UNKNOWN";
+        case INVALID    :   return "TOKEN : INVALID";
+        case TOKEN_COUNT:   break;
     }
+    return "TOKEN : ?";
 }
 
 Tokenizer::Tokenizer()
-    : lastSym(' ')
+    : Tokenizer(Source::fromStdin())
+{ }
+
+Tokenizer::Tokenizer(std::unique_ptr<Source> source, bool intern)
+    : source_(std::move(source)),
+      cur_(source_->begin()),
+      end_(source_->end()),
+      tokenStart_(cur_),
+      intern_(intern)
 { }
 
 TokenData Tokenizer::getToken()
 {
-    auto [token, data] = getTokenImpl();
-    return { token, data };
+    return getTokenImpl();
 }
 
 TokenData Tokenizer::getTokenImpl()
 {
-    auto currentIdent = parseToken();
+    int sym = skipBlank();
 
-    if (currentIdent == "") {
-        return { TokenType::END, nullptr };
+    if (sym == EOF) {
+        return { .type = TokenType::END };
     }
-    if (currentIdent == "fun") {
-        return { TokenType::FUNC, nullptr };
+    if (std::isdigit(sym)) {
+        return readNumber();
     }
-    if (currentIdent == "extern") {
-        return { TokenType::EXT, nullptr };
+    if (!std::isalpha(sym)) {
+        return readSymbol();
     }
-    if (currentIdent == "ret") {
-        return { TokenType::RET, nullptr };
-    }
-    if (currentIdent == "if") {
-        return { TokenType::IF, nullptr };
+
+    auto currentIdent = readWord();
+    auto type = classifyWord(currentIdent);
+    if (type != TokenType::IDENT) {
+        return { .type = type, .text = currentIdent };
     }
-    if (currentIdent == "else") {
-        return { TokenType::ELSE, nullptr };
+    return parseValue(currentIdent);
+}
+
+bool Tokenizer::fill()
+{
+    if (cur_ != end_) {
+        return true;
     }
-    if (currentIdent == "for") {
-        return { TokenType::FOR, nullptr };
+    bool more = source_->refill(tokenStart_, cur_);
+    end_ = source_->end();
+    return more;
+}
+
+void Tokenizer::skipComment()
+{
+    while (true) {
+        tokenStart_ = cur_; // nothing to keep
+        if (!fill()) {
+            return;
+        }
+        cur_ = Scan::skipLine(cur_, end_);
+        if (cur_ != end_) {
+            ++cur_; // eject line end
+            return;
+        }
     }
-    return parseValue(currentIdent);
 }
 
-void Tokenizer::skipComment() const
+int Tokenizer::skipBlank()
 {
-    char sym = '\0';
-    while (sym != EOF && sym != '\n' && sym != '\r') {
-        sym = getchar();
+    while (true) {
+        tokenStart_ = cur_;
+        if (!fill()) {
+            return EOF;
+        }
+
+        // skip spaces
+        cur_ = Scan::skipSpaces(cur_, end_);
+        if (cur_ == end_) {
+            continue;
+        }
+
+        int sym = static_cast<unsigned char>(*cur_);
+        if (sym == '#') {
+            skipComment();
+            continue;
+        }
+
+        tokenStart_ = cur_;
+        return sym;
     }
 }
 
-std::string Tokenizer::parseToken()
+std::string_view Tokenizer::readWord()
 {
-    // skip spaces
-    while (std::isspace(lastSym) || lastSym == '\n') {
-        lastSym = std::getchar();
+    ++cur_;
+    do {
+        cur_ = Scan::skipAlnum(cur_, end_);
+    } while (cur_ == end_ && fill());
+    return lexeme();
+}
+
+TokenData Tokenizer::readSymbol()
+{
+    // longest match for two char operators
+    ++cur_;
+    if (fill()) {
+        auto type = classifyPair(*tokenStart_, *cur_);
+        if (type != UNKNOWN) {
+            ++cur_;
+            return { .type = type, .text = lexeme() };
+        }
     }
+    return { .type = classifySymbol(*tokenStart_), .text = lexeme() };
+}
+
+TokenData Tokenizer::readNumber()
+{
+    uint64_t base = 10;
+    // 2^63 is only valid after '-', the parser checks the sign
+    uint64_t limit = uint64_t(INT64_MAX) + 1;
+    size_t digits = 0;
 
-    if (lastSym == '#') {
-        skipComment();
-        lastSym = getchar();
+    // 0x.. and 0b.. cover the whole 64 bits, for masks
+    if (*cur_ == '0') {
+        ++cur_;
+        ++digits;
+        int prefix = fill() ? (*cur_ | 0x20) : EOF;
+        if (prefix == 'x' || prefix == 'b') {
+            base = prefix == 'x' ? 16 : 2;
+            limit = UINT64_MAX;
+            digits = 0;
+            ++cur_;
+        }
     }
 
-    if (lastSym == EOF) { return ""; }
+    uint64_t value = 0;
+    bool overflow = false;
+    bool malformed = false;
+    bool separator = false;
+
+    while (fill()) {
+        char sym = *cur_;
+        if (sym == '_') {
+            malformed |= digits == 0 || separator;
+            separator = true;
+            ++cur_;
+            continue;
+        }
 
-    if (std::isalnum(lastSym)) {
-        return readWord();
+        int digit = digitValue(sym);
+        if (digit < 0) {
+            break;
+        }
+        if (static_cast<uint64_t>(digit) >= base) {
+            malformed = true;
+        }
+        else {
+            overflow |= __builtin_mul_overflow(value, base, &value);
+            overflow |= __builtin_add_overflow(value, static_cast<uint64_t>(digit), &value);
+            overflow |= value > limit;
+        }
+        ++digits;
+        separator = false;
+        ++cur_;
     }
+    malformed |= digits == 0 || separator;
 
-    std::string sym{lastSym};
-    lastSym = getchar();
-    return sym;
+    if (malformed) {
+        return { .type = TokenType::INVALID, .text = lexeme(), .error = "malformed integer literal" };
+    }
+    if (overflow) {
+        return { .type = TokenType::INVALID, .text = lexeme(), .error = "integer literal is out of range" };
+    }
+    return { .type = TokenType::INT, .value = static_cast<int64_t>(value), .text = lexeme() };
 }
 
-std::string Tokenizer::readWord()
+std::string_view Tokenizer::lexeme() const
 {
-    std::string currentIdent = {};
-    do {
-        currentIdent += lastSym;
-        lastSym = getchar();
-    } while (isalnum(lastSym) && lastSym != EOF && lastSym != ' ' && lastSym != ';' && lastSym != '\n');
-    return currentIdent;
+    return { tokenStart_, static_cast<size_t>(cur_ - tokenStart_) };
 }
 
-TokenData Tokenizer::parseValue(const std::string& value)
+TokenData Tokenizer::parseValue(std::string_view value)
 {
-    if (isInt(value)) {
-        return { TokenType::INT, new int64_t(std::stoll(value)) };
-    }
     // if (isFloat(value)) {
-    //     return { TokenType::FLOAT, new double(std::stod(value)) };
+    //     return { .type = TokenType::FLOAT, ... };
     // }
     // if (value[0] == '"') {
-    //     return { TokenType::STR, new std::string(value.substr(1, value.size() - 2)) };
+    //     return { .type = TokenType::STR, .text = value.substr(1, value.size() - 2) };
     // }
     // if (value == "true" || value == "false") {
-    //     return { TokenType::BOOL, new bool(value == "true") };
+    //     return { .type = TokenType::BOOL, .value = value == "true" };
     // }
-    return { TokenType::IDENT, new std::string(value) };
+    if (!intern_) {
+        return { .type = TokenType::IDENT, .text = value };
+    }
+    return { .type = TokenType::IDENT, .symbol = Symbol::intern(value), .text = value };
 }
 
 } // namespace Token
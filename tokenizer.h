@@ -1,74 +1,192 @@
 #pragma once
 
 #include "debug.h"
+#include "source.h"
+#include "symbol.h"
 
-#include <map>
+#include <array>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 
 
 namespace Token {
 
-enum TokenType {
-    END     = -1, // EOF
+enum TokenType : uint8_t {
+    END,            // EOF
 
     // -- Commands
-    FUNC    = -2,   // def of func
-    EXT     = -3,   // extern of module
-    RET     = -4,   // func return
+    FUNC,           // def of func
+    EXT,            // extern of module
+    RET,            // func return
+    BINARY,         // user-defined binary operator
 
     // -- Values
-    INT     = -7,
-    IDENT   = -10,  // identifier
+    INT,
+    IDENT,          // identifier
 
     // -- Statements
     // if/else
-    IF      = -11,
-    ELSE    = -12,
+    IF,
+    ELSE,
 
     // for
-    FOR     = -13,
+    FOR,
+
+    // var/in
+    VAR,
+    IN,
+
+    // -- Punctuation
+    LPAREN,         // (
+    RPAREN,         // )
+    COMMA,          // ,
+    SEMICOLON,      // ;
+    COLON,          // :
+
+    // -- Operators
+    ASSIGN,         // =
+    LESS,           // <
+    GREATER,        // >
+    LESS_EQ,        // <=
+    GREATER_EQ,     // >=
+    EQ,             // ==
+    NOT_EQ,         // !=
+    AND,            // &&
+    OR,             // ||
+    BIT_AND,        // &
+    BIT_OR,         // |
+    SHL,            // <<
+    SHR,            // >>
+    PLUS,           // +
+    MINUS,          // -
+    MUL,            // *
+    DIV,            // /
+    MOD,            // %
+
+    UNKNOWN,        // any other symbol
+    INVALID,        // malformed lexeme, see TokenData::error
+
+    TOKEN_COUNT,
 };
 
-static const std::map<std::string, int> binopPrecedence = {
-    { "=",  0 },
+enum class Assoc : uint8_t {
+    LEFT,
+    RIGHT,
+};
 
-    { "<", 10 },
-    { ">", 10 },
+struct BinopInfo {
+    int precedence = -1; // -1 for tokens that are not binary operators
+    Assoc assoc = Assoc::LEFT;
+    std::string_view spelling;
+};
 
-    { "+", 20 },
-    { "-", 20 },
+constexpr auto binopTable = [] {
+    std::array<BinopInfo, TOKEN_COUNT> table{};
 
-    { "*", 40 },
-    { "/", 40 },
-};
+    table[ASSIGN]       = {  0, Assoc::RIGHT, "="  };
+
+    table[OR]           = {  2, Assoc::LEFT,  "||" };
+    table[AND]          = {  3, Assoc::LEFT,  "&&" };
+
+    table[BIT_OR]       = {  4, Assoc::LEFT,  "|"  };
+    table[BIT_AND]      = {  5, Assoc::LEFT,  "&"  };
+
+    table[EQ]           = {  8, Assoc::LEFT,  "==" };
+    table[NOT_EQ]       = {  8, Assoc::LEFT,  "!=" };
+
+    table[LESS]         = { 10, Assoc::LEFT,  "<"  };
+    table[GREATER]      = { 10, Assoc::LEFT,  ">"  };
+    table[LESS_EQ]      = { 10, Assoc::LEFT,  "<=" };
+    table[GREATER_EQ]   = { 10, Assoc::LEFT,  ">=" };
+
+    table[SHL]          = { 15, Assoc::LEFT,  "<<" };
+    table[SHR]          = { 15, Assoc::LEFT,  ">>" };
+
+    table[PLUS]         = { 20, Assoc::LEFT,  "+"  };
+    table[MINUS]        = { 20, Assoc::LEFT,  "-"  };
+
+    table[MUL]          = { 40, Assoc::LEFT,  "*"  };
+    table[DIV]          = { 40, Assoc::LEFT,  "/"  };
+    table[MOD]          = { 40, Assoc::LEFT,  "%"  };
+
+    return table;
+}();
 
-int getTokenPrecedence(const std::string& token);
+constexpr int getTokenPrecedence(TokenType token)
+{
+    return binopTable[token].precedence;
+}
 
-typedef std::pair<TokenType, void*> TokenData;
+constexpr bool isRightAssoc(TokenType token)
+{
+    return binopTable[token].assoc == Assoc::RIGHT;
+}
 
-void freeToken(TokenData token);
+// Token kind with its payload stored inline
+struct TokenData {
+    TokenType type = END;
+
+    // INT
+    int64_t value = 0;
+
+    // IDENT
+    Symbol::Id symbol = 0;
+
+    // lexeme, slice of the source valid until the next token is read
+    std::string_view text = {};
+
+    // INVALID
+    const char *error = nullptr;
+};
+
+// punctuation or operator, UNKNOWN for anything else
+TokenType classifySymbol(char sym);
 
 std::string tokenToString(TokenType token);
 
 class Tokenizer {
 public:
 
+    // reads stdin
     Tokenizer();
 
+    // Without `intern`, IDENT tokens carry only their text
+    // and the caller assigns the symbols.
+    explicit Tokenizer(std::unique_ptr<Source> source, bool intern = true);
+
     TokenData getToken();
 
 private:
     TokenData getTokenImpl();
 
-    std::string parseToken();
+    // skips spaces and comments, returns the first char of the token or EOF
+    int skipBlank();
+
+    // returned lexemes are slices of the source,
+    // valid until the next token is read
+    std::string_view readWord();
+
+    TokenData readSymbol();
+
+    // value is accumulated while scanning, with overflow checks
+    TokenData readNumber();
+
+    std::string_view lexeme() const;
 
-    std::string readWord();
+    void skipComment();
 
-    void skipComment() const;
+    TokenData parseValue(std::string_view value);
 
-    TokenData parseValue(const std::string& value);
+    // makes sure cur_ points at input, false on EOF
+    bool fill();
 
-    char lastSym;
+    std::unique_ptr<Source> source_;
+    const char *cur_;
+    const char *end_;
+    const char *tokenStart_;
+    bool intern_;
 };
 
 } // namespace Token